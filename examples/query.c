@@ -126,6 +126,18 @@ int main(int argc, char** argv) {
     SINFO("Iterating over only active employees");
     ecs_query_iterate(active_employee_query, iterate_active_employees);
 
+    // Queries can also be iterated in place with ECS_QUERY_EACH
+    // Each (type, name) pair is a pointer to the query component at the same index
+    // break leaves the whole loop, so this stops at the first match
+    SINFO("");
+    SINFO("Finding an employee with a salary above 60000");
+    ECS_QUERY_EACH(employee_query, (name_t, name), (employee_t, employee), (salary_t, salary)) {
+        if (salary->value > 60000) {
+            SINFO("\tEmployee %s (ID %d) earns %d", name->value, employee->id, salary->value);
+            break;
+        }
+    }
+
     // Shutdown world
     ecs_world_shutdown(world);
 }
@@ -304,6 +316,18 @@ int main(int argc, char** argv) {
     SINFO("Iterating over only active employees");
     ecs_query_iterate(active_employee_query, iterate_active_employees);
 
+    // Queries can also be iterated in place with ECS_QUERY_EACH
+    // Each (type, name) pair is a pointer to the query component at the same index
+    // break leaves the whole loop, so this stops at the first match
+    SINFO("");
+    SINFO("Finding an employee with a salary above 60000");
+    ECS_QUERY_EACH(employee_query, (name_t, name), (employee_t, employee), (salary_t, salary)) {
+        if (salary->value > 60000) {
+            SINFO("\tEmployee %s (ID %d) earns %d", name->value, employee->id, salary->value);
+            break;
+        }
+    }
+
     // Shutdown world
     ecs_world_shutdown(world);
 }
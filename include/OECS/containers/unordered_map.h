@@ -33,7 +33,8 @@
         name##_hash_pair_t** tmp_table = sallocate(size * sizeof(name##_hash_pair_t*), MEMORY_TAG_ARRAY);                                       \
         name##_hash_pair_t* tmp_linked_lists = sallocate(size * sizeof(name##_hash_pair_t) * HASHMAP_MAX_LINKED_LIST_LENGTH, MEMORY_TAG_ARRAY); \
         for (u32 i = 0; i < size * HASHMAP_MAX_LINKED_LIST_LENGTH; i++) { tmp_linked_lists[i].hash = INVALID_ID_U64; }                          \
-        for (u32 i = 0, count = 0; i < map->capacity; i++) {                                                                                    \
+        u32 count = 0;                                                                                                                          \
+        for (u32 i = 0; i < map->capacity * HASHMAP_MAX_LINKED_LIST_LENGTH; i++) {                                                              \
             if (map->linked_lists[i].hash == INVALID_ID_U64) {                                                                                  \
                 continue;                                                                                                                       \
             }                                                                                                                                   \
@@ -55,6 +56,7 @@
         map->table = tmp_table;                                                                                                                 \
         map->linked_lists = tmp_linked_lists;                                                                                                   \
         map->capacity = size;                                                                                                                   \
+        map->count = count;                                                                                                                     \
     }                                                                                                                                           \
     void name##_create(u32 capacity, struct name* out_map) {                                                                                    \
         out_map->capacity = capacity;                                                                                                           \
@@ -74,6 +76,9 @@
         }                                                                                                                                              \
     }                                                                                                                                                  \
     value_type* name##_insert(struct name* map, key_type key, value_type value) {                                                                      \
+        if (map->count >= map->capacity * HASHMAP_MAX_LINKED_LIST_LENGTH) {                                                                            \
+            name##_resize(map, map->capacity * 2);                                                                                                     \
+        }                                                                                                                                              \
         u64 hash = hash_function(key);                                                                                                                 \
         u32 index = hash % map->capacity;                                                                                                              \
         name##_hash_pair_t* pair = map->table[index];                                                                                           \
@@ -0,0 +1,141 @@
+/**
+ * @file job_system.h
+ * @brief A small worker thread pool used by the ecs to run independent work in parallel.
+ */
+
+#pragma once
+
+#include "OECS/defines.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+/**
+ * @typedef job_function_t
+ * @brief A function that will be executed by the job system.
+ */
+typedef void (*job_function_t)(void* data);
+
+/**
+ * @typedef job_counter
+ * @brief Tracks the number of unfinished jobs in a group. Jobs submitted with a counter decrement it once they have finished.
+ *
+ */
+typedef struct job_counter {
+    atomic_uint remaining;
+} job_counter_t;
+
+/**
+ * @typedef job_info
+ * @brief A single unit of work that can be submitted to the job system.
+ *
+ */
+typedef struct job_info {
+    job_function_t function;
+    void* data;
+    job_counter_t* counter;
+} job_info_t;
+
+/**
+ * @typedef job_queue
+ * @brief A double ended queue of jobs owned by a single thread. The owner pushes and pops from the back while other threads steal from the front.
+ *
+ */
+typedef struct job_queue {
+    job_info_t* jobs;
+    u32 capacity;
+    u32 head;
+    u32 count;
+    pthread_mutex_t lock;
+} job_queue_t;
+
+struct job_system;
+
+/**
+ * @typedef job_worker
+ * @brief A single worker thread owned by a job system.
+ *
+ */
+typedef struct job_worker {
+    struct job_system* job_system;
+    pthread_t thread;
+    u32 index;
+} job_worker_t;
+
+/**
+ * @typedef job_system
+ * @brief A pool of worker threads. Each thread has its own job queue and steals from the other queues once its own is empty.
+ *
+ */
+typedef struct job_system {
+    /**
+     * @brief The worker threads. Does not include the thread that created the job system.
+     */
+    job_worker_t* workers;
+    /**
+     * @brief The number of worker threads.
+     */
+    u32 thread_count;
+    /**
+     * @brief The thread that created the job system. It uses thread index 0.
+     */
+    pthread_t owner;
+    /**
+     * @brief One queue per thread, indexed by job_system_thread_index. Contains thread_count + 1 queues.
+     */
+    job_queue_t* queues;
+    /**
+     * @brief The number of jobs waiting in all queues.
+     */
+    atomic_uint pending;
+    /**
+     * @brief Used with job_available to put idle workers to sleep.
+     */
+    pthread_mutex_t sleep_lock;
+    /**
+     * @brief Signalled when a job is submitted or the job system is shutting down.
+     */
+    pthread_cond_t job_available;
+    atomic_bool running;
+} job_system_t;
+
+#define JOB_SYSTEM_INITIAL_CAPACITY 256
+
+/**
+ * @brief Creates a job system and starts its worker threads.
+ *
+ * @param thread_count The number of worker threads to start. Can be zero, in which case all jobs are executed by job_system_wait.
+ * @param out_job_system The output job system.
+ */
+void job_system_create(u32 thread_count, job_system_t* out_job_system);
+/**
+ * @brief Stops all worker threads and frees the job system. Jobs still in the queue are not executed.
+ *
+ * @param job_system The job system to destroy.
+ */
+void job_system_destroy(job_system_t* job_system);
+/**
+ * @brief Adds a job to the calling thread's queue. If the job has a counter, it is incremented before the job is queued.
+ *
+ * @param job_system The target job system.
+ * @param job The job to execute.
+ */
+void job_system_submit(job_system_t* job_system, job_info_t job);
+/**
+ * @brief Blocks until a counter reaches zero. The calling thread executes queued jobs while waiting.
+ *
+ * @param job_system The job system the jobs were submitted to.
+ * @param counter The counter to wait on.
+ */
+void job_system_wait(job_system_t* job_system, job_counter_t* counter);
+/**
+ * @brief Returns the index of the calling thread within a job system. Zero for the thread that created the job system, 1 to thread_count for its workers.
+ * Asserts when called from any other thread, since those threads would share index 0 with the creating thread.
+ *
+ * @param job_system The job system the index belongs to.
+ */
+u32 job_system_thread_index(const job_system_t* job_system);
+/**
+ * @brief Returns the number of hardware threads available to the process.
+ */
+u32 job_system_hardware_thread_count();
@@ -28,6 +28,7 @@ void initialize_memory(u64* memory_requirement, void* state);
 void shutdown_memory();
 
 SAPI void*  pvt_sallocate(u64 size, memory_tag_t tag);
+SAPI void*  pvt_sallocate_aligned(u64 size, u64 alignment, memory_tag_t tag);
 SAPI void   pvt_spark_free(const void* block, u64 size, memory_tag_t tag);
 
 SAPI void* szero_memory(void* block, u64 size);
@@ -52,3 +53,6 @@ void  free_tracked_allocation(const void* block, u32 size, memory_tag_t tag);
 
 #endif
 
+// Aligned blocks can be freed with sfree
+#define sallocate_aligned(size, alignment, tag) pvt_sallocate_aligned(size, alignment, tag)
+
@@ -24,6 +24,74 @@ struct entity_archetype;
 
 set_header(ecs_component_id, ecs_component_set);
 
+// ================================
+// ECS Signature
+// ================================
+/**
+ * @brief The maximum number of components a world can define. Limited by the width of ecs_signature_t.
+ */
+#define ECS_MAX_COMPONENT_COUNT 256
+#define ECS_SIGNATURE_WORD_COUNT (ECS_MAX_COMPONENT_COUNT / 64)
+
+/**
+ * @typedef ecs_signature
+ * @brief A bitset with one bit per component id. Used to compare the component layouts of archetypes and queries without probing their component sets.
+ *
+ */
+typedef struct ecs_signature {
+    u64 words[ECS_SIGNATURE_WORD_COUNT];
+} ecs_signature_t;
+
+SINLINE void ecs_signature_add(ecs_signature_t* signature, ecs_component_id component) {
+    signature->words[component / 64] |= 1ULL << (component % 64);
+}
+
+SINLINE b8 ecs_signature_has(const ecs_signature_t* signature, ecs_component_id component) {
+    return (signature->words[component / 64] >> (component % 64)) & 1;
+}
+
+/**
+ * @brief Checks if every component in subset is also in signature.
+ */
+SINLINE b8 ecs_signature_contains_all(const ecs_signature_t* signature, const ecs_signature_t* subset) {
+    u64 missing = 0;
+    for (u32 i = 0; i < ECS_SIGNATURE_WORD_COUNT; i++) {
+        missing |= subset->words[i] & ~signature->words[i];
+    }
+    return missing == 0;
+}
+
+/**
+ * @brief Checks if the signatures share any component.
+ */
+SINLINE b8 ecs_signature_intersects(const ecs_signature_t* a, const ecs_signature_t* b) {
+    u64 shared = 0;
+    for (u32 i = 0; i < ECS_SIGNATURE_WORD_COUNT; i++) {
+        shared |= a->words[i] & b->words[i];
+    }
+    return shared != 0;
+}
+
+SINLINE b8 ecs_signature_equals(const ecs_signature_t* a, const ecs_signature_t* b) {
+    u64 different = 0;
+    for (u32 i = 0; i < ECS_SIGNATURE_WORD_COUNT; i++) {
+        different |= a->words[i] ^ b->words[i];
+    }
+    return different == 0;
+}
+
+SINLINE u64 ecs_signature_hash(const ecs_signature_t* signature) {
+    u64 hash = 0;
+    for (u32 i = 0; i < ECS_SIGNATURE_WORD_COUNT; i++) {
+        hash = hash_u64(hash ^ signature->words[i]);
+    }
+
+    // INVALID_ID_U64 marks an empty slot in hash maps
+    return hash == INVALID_ID_U64 ? 0 : hash;
+}
+
+hashmap_header(u64, u32, ecs_signature_map);
+
 // ================================
 // ECS Phases
 // ================================
@@ -50,24 +118,105 @@ typedef enum ecs_phase {
 /**
  * @typedef ecs_column
  * @brief Contains a packed array of component data. An archetype will have one column per component.
+ * Data is either a single contiguous array or, in chunked mode, a list of fixed size chunks that are never moved once allocated.
  *
  */
 typedef struct ecs_column {
+    /**
+     * @brief The component data. NULL in chunked mode.
+     */
     void* data;
+    /**
+     * @brief The chunks holding the component data, each with chunk_row_count rows. Only used in chunked mode.
+     */
+    void** chunks;
     ecs_index component_stride;
     ecs_index count;
     ecs_index capacity;
+    /**
+     * @brief The alignment of the column's data in bytes. At least ECS_COLUMN_ALIGNMENT.
+     */
+    u32 alignment;
+    /**
+     * @brief The number of rows in each chunk. Zero if the column is stored contiguously.
+     */
+    u32 chunk_row_count;
+    /**
+     * @brief The byte offset of the change ticks within each chunk. The ticks of a chunk are allocated with its data, after its rows, and are followed by the highest tick of the chunk. Only used in chunked mode.
+     */
+    u32 chunk_ticks_offset;
+    /**
+     * @brief The world change tick at which each row was last written, with one entry per row of capacity. NULL in chunked mode.
+     */
+    u32* change_ticks;
+    /**
+     * @brief The highest change tick of any row. Only used when the column is stored contiguously, chunks keep their own highest tick after their change ticks.
+     */
+    u32 max_change_tick;
 } ecs_column_t;
 
+/**
+ * @brief Returns a pointer to the component at a row of a column.
+ */
+SINLINE void* ecs_component_column_get(const ecs_column_t* column, ecs_index row) {
+    if (column->chunk_row_count == 0) {
+        return (u8*)column->data + row * column->component_stride;
+    }
+    return (u8*)column->chunks[row / column->chunk_row_count] + (row % column->chunk_row_count) * column->component_stride;
+}
+
+/**
+ * @brief Returns a pointer to the change tick of a row of a column. Ticks of rows within the same chunk are contiguous.
+ */
+SINLINE u32* ecs_component_column_get_change_tick(const ecs_column_t* column, ecs_index row) {
+    if (column->chunk_row_count == 0) {
+        return column->change_ticks + row;
+    }
+    return (u32*)((u8*)column->chunks[row / column->chunk_row_count] + column->chunk_ticks_offset) + row % column->chunk_row_count;
+}
+
+/**
+ * @brief Returns a pointer to the highest change tick of the chunk holding a row, or of the whole column if it is stored contiguously.
+ * It is never lower than the tick of any row it covers, so changed query terms can skip the rows when it is not newer than their last iteration.
+ */
+SINLINE u32* ecs_component_column_get_max_change_tick(ecs_column_t* column, ecs_index row) {
+    if (column->chunk_row_count == 0) {
+        return &column->max_change_tick;
+    }
+    return (u32*)((u8*)column->chunks[row / column->chunk_row_count] + column->chunk_ticks_offset) + column->chunk_row_count;
+}
+
+/**
+ * @brief Sets the change tick of count rows starting at row and raises the highest tick of their chunk. The rows must be in the same chunk.
+ * Parallel ranges can share a chunk or a contiguous column, so the highest tick is raised atomically.
+ */
+SINLINE void ecs_component_column_set_change_ticks(ecs_column_t* column, ecs_index row, u32 count, u32 change_tick) {
+    u32* change_ticks = ecs_component_column_get_change_tick(column, row);
+    for (u32 i = 0; i < count; i++) {
+        change_ticks[i] = change_tick;
+    }
+
+    u32* max_change_tick = ecs_component_column_get_max_change_tick(column, row);
+    u32 current = __atomic_load_n(max_change_tick, __ATOMIC_RELAXED);
+    while (current < change_tick && !__atomic_compare_exchange_n(max_change_tick, &current, change_tick, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
 #define ECS_COLUMN_RESIZE_FACTOR 2
+/**
+ * @brief The minimum alignment of column data. A cache line, so rows are never split across lines more than their stride requires and wide vector loads can be aligned.
+ */
+#define ECS_COLUMN_ALIGNMENT 64
 /**
  * @brief Creates a component column.
  *
  * @param initial_count The initial count of the column. Will be dynamically resized if data is added that excedes the current capacity.
  * @param component_stride The stride of the component the column represents.
+ * @param component_alignment The alignment of the component the column represents.
+ * @param chunk_row_count The number of rows per chunk, or zero to store the column contiguously.
  * @param out_column The output column.
  */
-void ecs_component_column_create(u32 initial_count, u32 component_stride, ecs_column_t* out_column);
+void ecs_component_column_create(u32 initial_count, u32 component_stride, u32 component_alignment, u32 chunk_row_count, ecs_column_t* out_column);
 /**
  * @brief Destroys a column and frees its data.
  *
@@ -75,7 +224,7 @@ void ecs_component_column_create(u32 initial_count, u32 component_stride, ecs_co
  */
 void ecs_component_column_destroy(ecs_column_t* column);
 /**
- * @brief Resizes a column to contain size number of elements.
+ * @brief Resizes a column to contain size number of elements. Chunked columns only allocate new chunks and never move existing data.
  *
  * @param column The column to be resized.
  * @param size The new number of elements of the column.
@@ -86,8 +235,16 @@ void ecs_component_column_resize(ecs_column_t* column, u32 size);
  *
  * @param column The target column.
  * @param data A pointer to the component to be added.
+ * @param change_tick The change tick of the new row.
  */
-void ecs_component_column_push(ecs_column_t* column, void* data);
+void ecs_component_column_push(ecs_column_t* column, void* data, u32 change_tick);
+/**
+ * @brief Pushes a zeroed component into a column. The column may be resized if required.
+ *
+ * @param column The target column.
+ * @param change_tick The change tick of the new row.
+ */
+void ecs_component_column_push_zeroed(ecs_column_t* column, u32 change_tick);
 /**
  * @brief Removes a component from a column.
  *
@@ -109,6 +266,10 @@ darray_header(ecs_column_t, ecs_column);
 typedef struct ecs_record {
     ecs_index index;
     u32 archetype_index;
+    /**
+     * @brief The generation of the entity currently using this record. Incremented when the entity is destroyed.
+     */
+    u32 generation;
 } entity_record_t;
 darray_header(entity_record_t, entity_record);
 
@@ -117,7 +278,21 @@ darray_header(entity_record_t, entity_record);
 // ================================
 struct entity_archetype;
 darray_header(struct entity_archetype*, entity_archetype_ptr);
-hashmap_header(ecs_component_id, struct entity_archetype*, entity_archetype_ptr_map);
+
+/**
+ * @typedef entity_archetype_edge_target
+ * @brief The archetype an edge leads to and how to move component data into it.
+ *
+ */
+typedef struct entity_archetype_edge_target {
+    u32 archetype_id;
+    /**
+     * @brief One entry per column of the target archetype. Holds the index of the source column to copy from, or INVALID_ID if the column should be zeroed.
+     */
+    u32* column_map;
+    u32 column_count;
+} entity_archetype_edge_target_t;
+hashmap_header(ecs_component_id, entity_archetype_edge_target_t, entity_archetype_edge_map);
 
 /**
  * @typedef entity_archetype_edge
@@ -125,10 +300,23 @@ hashmap_header(ecs_component_id, struct entity_archetype*, entity_archetype_ptr_
  *
  */
 typedef struct entity_archetype_edge {
-    entity_archetype_ptr_map_t add_edges;
-    entity_archetype_ptr_map_t remove_edges;
+    entity_archetype_edge_map_t add_edges;
+    entity_archetype_edge_map_t remove_edges;
 } entity_archetype_edge_t;
 
+struct ecs_query;
+darray_header(struct ecs_query*, ecs_query_ptr);
+/**
+ * @typedef entity_archetype_query_match
+ * @brief A query that matches an archetype, and the archetype's index in that query's matched archetypes.
+ *
+ */
+typedef struct entity_archetype_query_match {
+    struct ecs_query* query;
+    u32 match_index;
+} entity_archetype_query_match_t;
+darray_header(entity_archetype_query_match_t, entity_archetype_query_match);
+
 // ================================
 // Entity Archetype
 // ================================
@@ -158,8 +346,66 @@ typedef struct entity_archetype {
      * @brief The id for the archetype.
      */
     ecs_index archetype_id;
+    /**
+     * @brief A bitset of the components in the archetype.
+     */
+    ecs_signature_t signature;
+    /**
+     * @brief The id of the next archetype whose signature has the same hash, or INVALID_ID.
+     */
+    u32 next_with_hash;
+    /**
+     * @brief The number of rows in each chunk of the archetype's columns. Zero if the columns are stored contiguously.
+     */
+    u32 chunk_row_count;
+    /**
+     * @brief One bit per row, set if the entity in that row is disabled. Stored inverted so rows added to the archetype are enabled without touching the mask. Words past the end of the mask are all enabled.
+     */
+    darray_u64_t disabled_mask;
+    /**
+     * @brief The number of disabled rows. Queries only check the mask when it is non-zero.
+     */
+    u32 disabled_count;
+    /**
+     * @brief Every query that matches the archetype. Used to update the queries' lists of non-empty archetypes when the archetype becomes empty or non-empty.
+     */
+    darray_entity_archetype_query_match_t query_matches;
 } entity_archetype_t; 
 
+/**
+ * @brief Returns the number of rows starting at row that are stored contiguously in every column of an archetype. Never crosses a chunk boundary.
+ *
+ * @param archetype The target archetype.
+ * @param row The first row.
+ */
+SINLINE u32 entity_archetype_contiguous_rows(const entity_archetype_t* archetype, ecs_index row) {
+    u32 remaining = archetype->entities.count - row;
+    if (archetype->chunk_row_count == 0) {
+        return remaining;
+    }
+    u32 chunk_remaining = archetype->chunk_row_count - row % archetype->chunk_row_count;
+    return remaining < chunk_remaining ? remaining : chunk_remaining;
+}
+
+/**
+ * @brief Checks if the entity in a row of an archetype is enabled.
+ */
+SINLINE b8 entity_archetype_row_enabled(const entity_archetype_t* archetype, ecs_index row) {
+    u32 word = row / 64;
+    return word >= archetype->disabled_mask.count || ((archetype->disabled_mask.data[word] >> (row % 64)) & 1) == 0;
+}
+
+/**
+ * @brief Returns the column of a component in an archetype, or NULL if the component is a tag. Tags are ordered after every component with data in the archetype's component set, so their index is past the last column.
+ *
+ * @param archetype The target archetype. Must have the component.
+ * @param component The target component.
+ */
+SINLINE ecs_column_t* entity_archetype_get_column(entity_archetype_t* archetype, ecs_component_id component) {
+    u32 index = ecs_component_set_get_index(&archetype->component_set, component);
+    return index < archetype->columns.count ? &archetype->columns.data[index] : NULL;
+}
+
 /**
  * @brief Creates an archetype for a given world.
  *
@@ -185,6 +431,72 @@ entity_archetype_t* entity_archetype_create_from_base(struct ecs_world* world, e
  * @param archetype The archetype to be freed.
  */
 void entity_archetype_destroy(entity_archetype_t* archetype);
+/**
+ * @brief Finds the archetype with exactly the given components, creating it and matching it to existing queries if it does not exist.
+ *
+ * @param world The world the archetype is in.
+ * @param component_count The number of components.
+ * @param components The components of the archetype. Does not need to be sorted.
+ * @return A pointer to the archetype owned by the world. Only valid until the next archetype is created.
+ */
+entity_archetype_t* entity_archetype_get_or_create(struct ecs_world* world, u32 component_count, const ecs_component_id* components);
+/**
+ * @brief Moves an entity and its component data to another archetype. Components the destination does not have are dropped and components the source does not have are zeroed.
+ *
+ * @param world The world the entity is in.
+ * @param entity The entity to move.
+ * @param dest_archetype The archetype to move the entity to.
+ */
+void entity_transition_archetype(struct ecs_world* world, entity_t entity, entity_archetype_t* dest_archetype);
+/**
+ * @brief Moves an entity to another archetype using a precomputed column map, such as the one stored on an archetype edge.
+ *
+ * @param world The world the entity is in.
+ * @param entity The entity to move.
+ * @param dest_archetype The archetype to move the entity to.
+ * @param column_map For each column of dest_archetype, the source column to copy from or INVALID_ID to zero it.
+ */
+void entity_transition_archetype_mapped(struct ecs_world* world, entity_t entity, entity_archetype_t* dest_archetype, const u32* column_map);
+/**
+ * @brief Maps each column of an archetype to the column of another archetype holding the same component. Used to build the column maps passed to entity_transition_archetype_mapped.
+ *
+ * @param source The archetype entities are moved from.
+ * @param dest The archetype entities are moved to.
+ * @param out_column_map The output map. Must hold one entry per column of dest.
+ */
+void entity_archetype_build_column_map(entity_archetype_t* source, entity_archetype_t* dest, u32* out_column_map);
+/**
+ * @brief Adds an add edge from an archetype to the archetype with one more component, and the matching remove edge back. Does nothing if the edges already exist.
+ *
+ * @param world The world the archetypes are in.
+ * @param archetype_id The archetype without the component.
+ * @param added_archetype_id The archetype with the component.
+ * @param component The component that differs between the archetypes.
+ */
+void entity_archetype_connect(struct ecs_world* world, u32 archetype_id, u32 added_archetype_id, ecs_component_id component);
+/**
+ * @brief Grows the storage of an archetype so that row_count more entities can be added without reallocating.
+ *
+ * @param archetype The target archetype.
+ * @param row_count The number of entities that will be added.
+ */
+void entity_archetype_reserve(entity_archetype_t* archetype, u32 row_count);
+/**
+ * @brief Removes a row from an archetype by moving the last row into its place. Updates the record of the moved entity.
+ *
+ * @param world The world the archetype is in.
+ * @param archetype The target archetype.
+ * @param row The row to remove.
+ */
+void entity_archetype_remove_row(struct ecs_world* world, entity_archetype_t* archetype, ecs_index row);
+/**
+ * @brief Enables or disables the entity in a row of an archetype. Disabled rows are skipped by queries.
+ *
+ * @param archetype The target archetype.
+ * @param row The target row.
+ * @param enabled Whether the row should be enabled.
+ */
+void entity_archetype_set_row_enabled(entity_archetype_t* archetype, ecs_index row, b8 enabled);
 /**
  * @brief Prints debug information about an archetype.
  *
@@ -192,18 +504,115 @@ void entity_archetype_destroy(entity_archetype_t* archetype);
  */
 void entity_archetype_print_debug(entity_archetype_t* archetype);
 /**
- * @brief Matches an archetype to existing queries in a world. This allows exising queries to iterate over newly created archetypes.
+ * @brief Matches an archetype to existing queries in a world. This allows exising queries to iterate over newly created archetypes. Only the queries indexed under the archetype's components and the world's unindexed queries are checked.
  *
  * @param archetyle The target archetype.
  * @param world The ecs world to match to.
  */
 void entity_archetype_match_queryies(entity_archetype_t* archetyle, struct ecs_world* world);
+/**
+ * @brief Updates the non-empty archetype lists of the queries that match an archetype. Must be called whenever the archetype's first entity is added or its last entity is removed.
+ *
+ * @param archetype The target archetype.
+ */
+void entity_archetype_update_queries(entity_archetype_t* archetype);
 
 darray_header(entity_archetype_t, entity_archetype);
 
+// ================================
+// ECS Sparse Set
+// ================================
+/**
+ * @typedef ecs_sparse_set
+ * @brief Stores one component for any number of entities outside of archetypes. Entities are added and removed in constant time without moving their other components.
+ *
+ */
+typedef struct ecs_sparse_set {
+    /**
+     * @brief Maps an entity index to its row in column, or INVALID_ID if the entity does not have the component.
+     */
+    darray_u32_t sparse;
+    /**
+     * @brief The entity stored in each row of column.
+     */
+    darray_entity_t dense;
+    /**
+     * @brief The component data, packed without gaps. Always stored contiguously.
+     */
+    ecs_column_t column;
+} ecs_sparse_set_t;
+
+/**
+ * @brief Creates an empty sparse set.
+ *
+ * @param stride The stride of the component.
+ * @param alignment The alignment of the component.
+ * @param out_set The output sparse set.
+ */
+void ecs_sparse_set_create(u32 stride, u32 alignment, ecs_sparse_set_t* out_set);
+/**
+ * @brief Destroys a sparse set and frees its data.
+ *
+ * @param set The sparse set to destroy.
+ */
+void ecs_sparse_set_destroy(ecs_sparse_set_t* set);
+/**
+ * @brief Adds a zeroed component for an entity. Does nothing if the entity already has it.
+ *
+ * @param set The target sparse set.
+ * @param entity The target entity.
+ * @param change_tick The change tick of the new component.
+ * @return A pointer to the entity's component.
+ */
+void* ecs_sparse_set_insert(ecs_sparse_set_t* set, entity_t entity, u32 change_tick);
+/**
+ * @brief Removes an entity's component by moving the last component into its place. Does nothing if the entity does not have it.
+ *
+ * @param set The target sparse set.
+ * @param entity The target entity.
+ */
+void ecs_sparse_set_remove(ecs_sparse_set_t* set, entity_t entity);
+
+/**
+ * @brief Returns the row of an entity in a sparse set, or INVALID_ID if it does not have the component.
+ */
+SINLINE u32 ecs_sparse_set_row(const ecs_sparse_set_t* set, entity_t entity) {
+    u32 entity_index = ENTITY_INDEX(entity);
+    return entity_index < set->sparse.count ? set->sparse.data[entity_index] : INVALID_ID;
+}
+
+SINLINE b8 ecs_sparse_set_contains(const ecs_sparse_set_t* set, entity_t entity) {
+    return ecs_sparse_set_row(set, entity) != INVALID_ID;
+}
+
+/**
+ * @brief Returns a pointer to an entity's component, or NULL if it does not have the component.
+ */
+SINLINE void* ecs_sparse_set_get(const ecs_sparse_set_t* set, entity_t entity) {
+    u32 row = ecs_sparse_set_row(set, entity);
+    return row != INVALID_ID ? ecs_component_column_get(&set->column, row) : NULL;
+}
+
 // ================================
 // ECS Component
 // ================================
+/**
+ * @typedef ecs_storage_kind
+ * @brief Where a component's data is stored.
+ *
+ */
+typedef enum ecs_storage_kind {
+    /**
+     * @brief The component is a column of every archetype that has it. Fastest to iterate, but adding or removing it moves the entity's whole row to another archetype.
+     */
+    ECS_STORAGE_TABLE,
+    /**
+     * @brief The component is kept in a sparse set on the component and is not part of any archetype. Adding and removing it is constant time, which suits components that are toggled often.
+     * Queries can require or exclude it, but only use it as a filter and do not provide its data.
+     */
+    ECS_STORAGE_SPARSE,
+} ecs_storage_kind_t;
+
         /**
          * @class ecs_component
          * @brief Contains data about an archetype. Can be accessed via an ecs_component_id as the index.
@@ -211,13 +620,30 @@ darray_header(entity_archetype_t, entity_archetype);
          */
 typedef struct ecs_component {
     /**
-     * @brief All archetypes that a componet is in.
+     * @brief The ids of all archetypes that a componet is in. Ids are used instead of pointers since pointers into the world's archetypes are invalidated when it grows.
+     */
+    darray_u32_t archetypes;
+    /**
+     * @brief The queries indexed under the component. Each query is indexed under one component it requires, so a new archetype is only matched against the queries indexed under its own components.
      */
-    darray_entity_archetype_ptr_t archetypes;
+    darray_ecs_query_ptr_t queries;
     /**
      * @brief Stride of the component in bytes.
      */
     u32 stride;
+    /**
+     * @brief Alignment of the component in bytes.
+     */
+    u32 alignment;
+    ecs_storage_kind_t storage;
+    /**
+     * @brief The component data of every entity that has the component. Only used by ECS_STORAGE_SPARSE components.
+     */
+    ecs_sparse_set_t sparse_set;
+    /**
+     * @brief The world's resource of this component, or NULL if it has none. Allocated on its own so pointers to it stay valid.
+     */
+    void* resource;
     /**
      * @brief Name of the component.
      */
@@ -228,6 +654,8 @@ darray_header(ecs_component_t, ecs_component);
 // ================================
 // ECS iterator 
 // ================================
+#define MAX_QUERY_COMPONENT_COUNT 32
+
         /**
          * @class ecs_iterator
          * @brief A container for all data required to iterate over all entities in an archetype.
@@ -235,10 +663,45 @@ darray_header(ecs_component_t, ecs_component);
          */
 typedef struct ecs_iterator {
     ecs_world_t* world;
-    void** component_data;
+    /**
+     * @brief The command buffer of the thread running the iterator. Structural changes made while iterating must be recorded here instead of being applied directly.
+     */
+    struct ecs_command_buffer* commands;
+    /**
+     * @brief One array per query component. Each array starts at row_offset, so index 0 is the first entity of the range. NULL for ECS_STORAGE_SPARSE components and tags.
+     */
+    void* component_data[MAX_QUERY_COMPONENT_COUNT];
+    /**
+     * @brief The entities in the range, in the same order as component_data.
+     */
+    const entity_t* entities;
     entity_archetype_t* archetype;
     u32 component_count;
+    /**
+     * @brief The number of entities in the range.
+     */
     u32 entity_count;
+    /**
+     * @brief The index of the first entity of the range within the archetype. Ranges start past zero when the query is iterated in parallel, the archetype is chunked or rows are filtered out.
+     */
+    u32 row_offset;
+    /**
+     * @brief The query being iterated by ecs_iterator_next.
+     */
+    struct ecs_query* query;
+    /**
+     * @brief The index into the query's non-empty archetypes and the row that ecs_iterator_next continues from.
+     */
+    u32 archetype_cursor;
+    u32 next_row;
+    /**
+     * @brief Rows written after this tick count as changed. Only used by queries with changed components.
+     */
+    u32 since_tick;
+    /**
+     * @brief The smallest sparse set required by a query without archetype terms, or NULL. If set, next_row is the index into its entities that ecs_iterator_next continues from.
+     */
+    const ecs_sparse_set_t* driving_set;
 } ecs_iterator_t;
 
 #define ECS_ITERATOR_GET_COMPONENTS(iterator, index) (iterator->component_data[index]); SASSERT(index < iterator->component_count, "Cannot get component at index %d from query with %d components", index, iterator->component_count)
@@ -247,6 +710,22 @@ typedef struct ecs_iterator {
 // ================================
 // ECS query 
 // ================================
+/**
+ * @typedef ecs_access
+ * @brief How a system accesses a component. Used to decide which systems can run at the same time.
+ *
+ */
+typedef enum ecs_access {
+    /**
+     * @brief The component may be read and written. This is the default for components without a declared access.
+     */
+    ECS_ACCESS_READ_WRITE,
+    /**
+     * @brief The component is only read.
+     */
+    ECS_ACCESS_READ,
+} ecs_access_t;
+
 /**
  * @class ecs_query_create_info
  * @brief Contains all info required to create a query. Used by ecs_query and ecs_system
@@ -257,6 +736,21 @@ typedef struct ecs_query_create_info {
     u32 without_component_count;
     const ecs_component_id* components;
     const ecs_component_id* without_components;
+    /**
+     * @brief Optional access mode for each entry in components. If NULL, every component is treated as ECS_ACCESS_READ_WRITE. Only used by ecs_system_create.
+     */
+    const ecs_access_t* component_access;
+    /**
+     * @brief Components that must have changed since the query was last iterated. An entity is visited if any of them changed. Entities must also have these components, but they are not added to component_data.
+     */
+    u32 changed_component_count;
+    const ecs_component_id* changed_components;
+    /**
+     * @brief World resources the system accesses, with an optional access mode for each. If resource_access is NULL, every resource is treated as ECS_ACCESS_READ_WRITE. Only used by ecs_system_create.
+     */
+    u32 resource_count;
+    const ecs_component_id* resources;
+    const ecs_access_t* resource_access;
 } ecs_query_create_info_t;
 
 /**
@@ -266,14 +760,54 @@ typedef struct ecs_query_create_info {
  */
 typedef struct ecs_query {
     darray_u32_t archetype_indices;
+    /**
+     * @brief The column of each term of the query in each matched archetype, cached when the archetype is matched. An archetype's columns never change once it is created, so the cache never needs to be rebuilt.
+     * Holds components.count + changed_components.count entries per entry of archetype_indices, components first. INVALID_ID for terms without a column, such as tags and sparse components.
+     */
+    darray_u32_t term_columns;
+    /**
+     * @brief The indices into archetype_indices of the matched archetypes that have entities, in no particular order. Iteration only visits these, so empty archetypes left behind by despawned entities cost nothing.
+     */
+    darray_u32_t non_empty_matches;
+    /**
+     * @brief One entry per entry of archetype_indices. Holds the archetype's position in non_empty_matches, or INVALID_ID if it is empty.
+     */
+    darray_u32_t non_empty_slots;
     darray_u32_t components;
     darray_u32_t without_components;
-    u32 hash;
+    /**
+     * @brief Bitsets of the required and excluded components, used to match archetypes.
+     */
+    ecs_signature_t signature;
+    ecs_signature_t without_signature;
+    /**
+     * @brief A hash of the query's terms. Queries are deduplicated on it through the world's query map.
+     */
+    u64 hash;
+    /**
+     * @brief The next query with the same hash but different terms.
+     */
+    struct ecs_query* next_with_hash;
+    /**
+     * @brief Components checked for changes. Queries with changed components are never shared, since each keeps its own last_change_tick.
+     */
+    darray_u32_t changed_components;
+    /**
+     * @brief The world change tick when the query was last iterated. Rows written after it count as changed.
+     */
+    u32 last_change_tick;
     ecs_world_t* world;
 } ecs_query_t;
 
-darray_header(ecs_query_t, ecs_query);
-#define MAX_QUERY_COMPONENT_COUNT 32
+hashmap_header(u64, ecs_query_t*, ecs_query_map);
+/**
+ * @brief The target number of bytes of component data in a single range used by ecs_query_iterate_parallel. Sized to fit comfortably in a core's L2 cache.
+ */
+#define ECS_QUERY_PARALLEL_RANGE_SIZE (64 * 1024)
+/**
+ * @brief The minimum number of entities in a single range used by ecs_query_iterate_parallel, so tiny components are not split into jobs that cost more to schedule than to run.
+ */
+#define ECS_QUERY_PARALLEL_MIN_RANGE_ROWS 256
 
 /**
  * @brief Creates an entity query for a given world based on the create info.
@@ -298,19 +832,83 @@ void ecs_query_destroy(ecs_query_t* query);
  */
 b8 ecs_query_matches_archetype(ecs_query_t* query, entity_archetype_t* archetype);
 /**
- * @brief Creates an iterator based on a query.
+ * @brief Adds a matching archetype to a query and caches the columns of the query's terms in it.
+ *
+ * @param query The target query.
+ * @param archetype An archetype that matches the query.
+ */
+void ecs_query_add_archetype(ecs_query_t* query, entity_archetype_t* archetype);
+/**
+ * @brief Adds a matched archetype to or removes it from a query's list of non-empty archetypes. Called through entity_archetype_update_queries.
+ *
+ * @param query The target query.
+ * @param match_index The index of the archetype in the query's matched archetypes.
+ * @param is_non_empty True if the archetype has entities.
+ */
+void ecs_query_set_archetype_non_empty(ecs_query_t* query, u32 match_index, b8 is_non_empty);
+/**
+ * @brief Creates an iterator over a query that is advanced with ecs_iterator_next, so entities can be visited from a plain loop instead of a callback:
+ *
+ *     ecs_iterator_t iterator;
+ *     ecs_query_create_iterator(query, &iterator);
+ *     while (ecs_iterator_next(&iterator)) {
+ *         position_t* positions = iterator.component_data[0];
+ *         for (u32 i = 0; i < iterator.entity_count; i++) { ... }
+ *     }
+ *
+ * Structural changes must be recorded in iterator.commands until the loop has finished. Writes are not marked as changed, use entity_mark_changed if the query's changes are tracked elsewhere.
  *
  * @param query The source query.
- * @param out_iterator A pointer to the output iterator.
+ * @param out_iterator A pointer to the output iterator. Has no range until ecs_iterator_next is called.
  */
 void ecs_query_create_iterator(ecs_query_t* query, ecs_iterator_t* out_iterator);
 /**
- * @brief Iterates over a query given an iterator.
+ * @brief Advances an iterator to the next range of entities. A range is a run of rows of a single archetype that are stored contiguously, so it never crosses a chunk boundary, and that pass the query's filters.
+ * Queries without archetype terms visit the entities of their smallest sparse set, one entity per range.
+ *
+ * @param iterator An iterator created by ecs_query_create_iterator.
+ * @return True if the iterator points at a new range, false if every range has been visited.
+ */
+b8 ecs_iterator_next(ecs_iterator_t* iterator);
+/**
+ * @brief Returns a new iterator over a query. Used by ECS_QUERY_EACH to create its iterator in a for loop.
+ */
+SINLINE ecs_iterator_t ecs_query_each_iterator(ecs_query_t* query) {
+    ecs_iterator_t iterator;
+    ecs_query_create_iterator(query, &iterator);
+    return iterator;
+}
+/**
+ * @brief Returns the data of a query component for the iterator's current range. Used by ECS_QUERY_EACH.
+ */
+SINLINE void* ecs_query_each_data(const ecs_iterator_t* iterator, u32 index) {
+    SASSERT(index < iterator->component_count, "Cannot get component at index %d from query with %d components", index, iterator->component_count);
+    SASSERT(iterator->component_data[index], "Query component %d has no data to iterate, sparse components and tags cannot be used in ECS_QUERY_EACH.", index);
+    return iterator->component_data[index];
+}
+/**
+ * @brief Iterates over a query given an iterator. Disabled entities are skipped.
  *
  * @param query The query to iterate over.
  * @param iterator The function that will for each entity archetype.
  */
 void ecs_query_iterate(ecs_query_t* query, void (iterate_function)(ecs_iterator_t* iterator));
+/**
+ * @brief Iterates over a query and marks every visited row of the written components as changed once the iterate function returns.
+ *
+ * @param query The query to iterate over.
+ * @param iterate_function The function that will be called for each range of entities.
+ * @param write_mask Bit i is set if the query's component i is written by the iterate function.
+ */
+void ecs_query_iterate_writes(ecs_query_t* query, void (iterate_function)(ecs_iterator_t* iterator), u32 write_mask);
+/**
+ * @brief Iterates over a query using the world's job system. Each matched archetype is split into ranges of at most ECS_QUERY_PARALLEL_RANGE_SIZE bytes of component data,
+ * and each range is passed to the iterate function on whichever thread picks it up. The iterate function must be safe to call from multiple threads at once. Returns once every range has been processed.
+ *
+ * @param query The query to iterate over.
+ * @param iterate_function The function that will be called for each range of entities.
+ */
+void ecs_query_iterate_parallel(ecs_query_t* query, void (iterate_function)(ecs_iterator_t* iterator));
 
 // ================================
 // ECS system
@@ -323,12 +921,25 @@ void ecs_query_iterate(ecs_query_t* query, void (iterate_function)(ecs_iterator_
 typedef struct ecs_system {
     ecs_query_t* query;
     void (*callback)(ecs_iterator_t* iterator);
+    /**
+     * @brief Components the system only reads.
+     */
+    darray_u32_t read_components;
+    /**
+     * @brief Components the system may write.
+     */
+    darray_u32_t write_components;
+    /**
+     * @brief Bit i is set if the system may write component i of its query. Rows it visits are marked as changed for those components.
+     */
+    u32 write_mask;
 #ifdef SPARK_DEBUG
     const char* name;
     f64 runtime;
     u32 calls;
 #endif
 } ecs_system_t;
+STATIC_ASSERT(sizeof(((ecs_system_t*)0)->write_mask) * 8 >= MAX_QUERY_COMPONENT_COUNT, "ecs_system_t::write_mask needs one bit per query component.");
 
 /**
  * @brief Creates a system for a given world.
@@ -349,10 +960,101 @@ void ecs_system_destroy(ecs_system_t* system);
 
 darray_header(ecs_system_t, ecs_system);
 
+/**
+ * @class ecs_schedule
+ * @brief The order systems in a phase are executed in. Systems are grouped into batches where no two systems in a batch conflict, allowing each batch to run in parallel.
+ *
+ */
+typedef struct ecs_schedule {
+    /**
+     * @brief Indices into the phase's systems, ordered by batch.
+     */
+    darray_u32_t system_indices;
+    /**
+     * @brief The offset into system_indices where each batch starts. Contains one extra entry marking the end of the last batch.
+     */
+    darray_u32_t batch_offsets;
+    /**
+     * @brief The conflict graph of the phase, stored as a system_count * system_count adjacency matrix. A non-zero entry means the two systems can not run at the same time.
+     */
+    darray_u8_t conflicts;
+    /**
+     * @brief Set when a system is added to the phase and the schedule needs to be rebuilt.
+     */
+    b8 dirty;
+} ecs_schedule_t;
+
+/**
+ * @brief Checks if two systems can not run at the same time.
+ *
+ * @param a The first system.
+ * @param b The second system.
+ * @return True if either system writes a component the other system reads or writes, false otherwise.
+ */
+b8 ecs_system_conflicts(const ecs_system_t* a, const ecs_system_t* b);
+/**
+ * @brief Rebuilds the conflict graph and schedule for a phase. Each system is placed in the batch after the last batch containing a system it conflicts with, so conflicting systems still run in the order they were created.
+ *
+ * @param systems The systems in the phase.
+ * @param schedule The schedule to rebuild.
+ */
+void ecs_schedule_build(darray_ecs_system_t* systems, ecs_schedule_t* schedule);
+/**
+ * @brief Runs a system over all entities matching its query. Used as a job function by ecs_world_progress.
+ *
+ * @param system A pointer to the ecs_system_t to run.
+ */
+void ecs_system_run(void* system);
+
 // ================================
 // Utility Macros
 // ================================
 #define ECS_COMPONENT_ID(component) ECS_##component##_ID
 #define ECS_COMPONENT_DECLARE(component) ecs_component_id ECS_COMPONENT_ID(component)
-#define ECS_SYSTEM_CREATE(world, phase, components, callback) ecs_system_create(world, phase, sizeof(components) / sizeof(ecs_component_id), callback, name)
+#define ECS_SYSTEM_CREATE(world, phase, create_info, callback) ecs_system_create(world, phase, create_info, callback, #callback)
+
+/**
+ * @brief Runs the block that follows it once per entity of a query, with a typed pointer to each listed component:
+ *
+ *     ECS_QUERY_EACH(query, (position_t, position), (velocity_t, velocity)) {
+ *         position->x += velocity->x * delta_time;
+ *     }
+ *
+ * Each (type, name) pair is the query component at the same index, and at most 8 can be listed. Sparse components and tags have no data and must come after the listed components.
+ * The loop is built on ecs_iterator_next and expands in place, so the block is inlined into a loop over restrict pointers to each range's columns that the compiler can vectorize.
+ * ECS_QUERY_EACH_ENTITY is the current entity. continue moves on to the next entity and break leaves the whole loop.
+ * The same rules as ecs_query_create_iterator apply: structural changes must be recorded in a command buffer and writes are not marked as changed.
+ */
+#define ECS_QUERY_EACH(query, ...) \
+    for (u8 ecs_each_broken = 0, ecs_each_once = 1; ecs_each_once; ecs_each_once = 0) \
+    for (ecs_iterator_t ecs_each_iterator = ecs_query_each_iterator(query); !ecs_each_broken && ecs_iterator_next(&ecs_each_iterator);) \
+    for (u8 ecs_each_range_once = 1; ecs_each_range_once; ecs_each_range_once = 0) \
+    ECS_EACH_CONCAT(ECS_EACH_FOR_, ECS_EACH_COUNT(__VA_ARGS__))(ECS_EACH_RANGE, 0, __VA_ARGS__) \
+    for (u32 ecs_each_row = 0; !ecs_each_broken && ecs_each_row < ecs_each_iterator.entity_count; ecs_each_row++) \
+    for (u8 ecs_each_row_once = 1; ecs_each_row_once; ecs_each_row_once = 0) \
+    ECS_EACH_CONCAT(ECS_EACH_FOR_, ECS_EACH_COUNT(__VA_ARGS__))(ECS_EACH_ROW, 0, __VA_ARGS__) \
+    for (ecs_each_broken = 1; ecs_each_broken; ecs_each_broken = 0)
+#define ECS_QUERY_EACH_ENTITY (ecs_each_iterator.entities[ecs_each_row])
+
+// Helpers for ECS_QUERY_EACH. Each component gets a loop that runs once, so the loops can declare pointers of different types.
+// The block runs inside a final loop that clears ecs_each_broken when the block finishes or continues. A break skips the clear, which ends every outer loop.
+#define ECS_EACH_CONCAT(a, b) ECS_EACH_CONCAT_(a, b)
+#define ECS_EACH_CONCAT_(a, b) a##b
+#define ECS_EACH_COUNT(...) ECS_EACH_COUNT_(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1)
+#define ECS_EACH_COUNT_(_1, _2, _3, _4, _5, _6, _7, _8, count, ...) count
+#define ECS_EACH_UNPACK(type, name) type, name
+#define ECS_EACH_APPLY(macro, index, pair) ECS_EACH_APPLY_(macro, index, ECS_EACH_UNPACK pair)
+#define ECS_EACH_APPLY_(macro, ...) macro(__VA_ARGS__)
+#define ECS_EACH_RANGE(index, type, name) \
+    for (type* restrict ecs_each_base_##name = ecs_query_each_data(&ecs_each_iterator, index); ecs_each_range_once; ecs_each_range_once = 0)
+#define ECS_EACH_ROW(index, type, name) \
+    for (type* const name = ecs_each_base_##name + ecs_each_row; ecs_each_row_once; ecs_each_row_once = 0)
+#define ECS_EACH_FOR_1(macro, index, pair) ECS_EACH_APPLY(macro, index, pair)
+#define ECS_EACH_FOR_2(macro, index, pair, ...) ECS_EACH_APPLY(macro, index, pair) ECS_EACH_FOR_1(macro, index + 1, __VA_ARGS__)
+#define ECS_EACH_FOR_3(macro, index, pair, ...) ECS_EACH_APPLY(macro, index, pair) ECS_EACH_FOR_2(macro, index + 1, __VA_ARGS__)
+#define ECS_EACH_FOR_4(macro, index, pair, ...) ECS_EACH_APPLY(macro, index, pair) ECS_EACH_FOR_3(macro, index + 1, __VA_ARGS__)
+#define ECS_EACH_FOR_5(macro, index, pair, ...) ECS_EACH_APPLY(macro, index, pair) ECS_EACH_FOR_4(macro, index + 1, __VA_ARGS__)
+#define ECS_EACH_FOR_6(macro, index, pair, ...) ECS_EACH_APPLY(macro, index, pair) ECS_EACH_FOR_5(macro, index + 1, __VA_ARGS__)
+#define ECS_EACH_FOR_7(macro, index, pair, ...) ECS_EACH_APPLY(macro, index, pair) ECS_EACH_FOR_6(macro, index + 1, __VA_ARGS__)
+#define ECS_EACH_FOR_8(macro, index, pair, ...) ECS_EACH_APPLY(macro, index, pair) ECS_EACH_FOR_7(macro, index + 1, __VA_ARGS__)
 
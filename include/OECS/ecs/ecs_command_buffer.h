@@ -0,0 +1,142 @@
+/**
+ * @file ecs_command_buffer.h
+ * @brief Records structural changes so they can be applied after iteration has finished.
+ */
+
+#pragma once
+
+#include "OECS/containers/darray.h"
+#include "OECS/containers/generic/darray_ints.h"
+#include "OECS/ecs/entity.h"
+
+struct ecs_world;
+
+/**
+ * @typedef ecs_command_type
+ * @brief The operation a command performs when its buffer is flushed.
+ *
+ */
+typedef enum ecs_command_type {
+    ECS_COMMAND_CREATE,
+    ECS_COMMAND_DESTROY,
+    ECS_COMMAND_ADD,
+    ECS_COMMAND_REMOVE,
+    ECS_COMMAND_SET,
+} ecs_command_type_t;
+
+/**
+ * @typedef ecs_command
+ * @brief A single recorded structural change.
+ *
+ */
+typedef struct ecs_command {
+    entity_t entity;
+    ecs_command_type_t type;
+    ecs_component_id component;
+    /**
+     * @brief The offset of the component value in the buffer's data. Only used by ECS_COMMAND_SET.
+     */
+    u32 data_offset;
+    /**
+     * @brief The size of the component value in bytes. Only used by ECS_COMMAND_SET.
+     */
+    u32 data_size;
+    /**
+     * @brief The order the command was recorded in. Used to keep sorting stable.
+     */
+    u32 sequence;
+} ecs_command_t;
+
+darray_header(ecs_command_t, ecs_command);
+
+/**
+ * @typedef ecs_command_buffer
+ * @brief A list of structural changes to apply to a world. Each thread of the world's job system has its own buffer, so recording does not need to be synchronized.
+ *
+ */
+typedef struct ecs_command_buffer {
+    darray_ecs_command_t commands;
+    /**
+     * @brief Component values recorded by ECS_COMMAND_SET commands.
+     */
+    darray_u8_t data;
+    /**
+     * @brief The number of entities created by the buffer since it was last flushed.
+     */
+    u32 pending_entity_count;
+    /**
+     * @brief Stored in the generation of the buffer's pending entities, so handles from other buffers can be detected.
+     */
+    u16 id;
+} ecs_command_buffer_t;
+
+/**
+ * @brief Creates an empty command buffer.
+ *
+ * @param out_buffer The output command buffer.
+ */
+void ecs_command_buffer_create(ecs_command_buffer_t* out_buffer);
+/**
+ * @brief Destroys a command buffer without applying its commands.
+ *
+ * @param buffer The command buffer to destroy.
+ */
+void ecs_command_buffer_destroy(ecs_command_buffer_t* buffer);
+/**
+ * @brief Records the creation of an entity.
+ *
+ * @param buffer The target command buffer.
+ * @return A pending entity handle. It can be used with other commands in the same buffer but is only a real entity once the buffer is flushed.
+ */
+entity_t ecs_command_buffer_create_entity(ecs_command_buffer_t* buffer);
+/**
+ * @brief Records the destruction of an entity.
+ *
+ * @param buffer The target command buffer.
+ * @param entity The entity to destroy.
+ */
+void ecs_command_buffer_destroy_entity(ecs_command_buffer_t* buffer, entity_t entity);
+/**
+ * @brief Records adding a zeroed component to an entity. Should be accessed via the ECS_COMMAND_BUFFER_ADD_COMPONENT(buffer, entity, component) macro.
+ *
+ * @param buffer The target command buffer.
+ * @param entity The target entity.
+ * @param component The component to add.
+ */
+void ecs_command_buffer_add_component(ecs_command_buffer_t* buffer, entity_t entity, ecs_component_id component);
+/**
+ * @brief Records removing a component from an entity. Should be accessed via the ECS_COMMAND_BUFFER_REMOVE_COMPONENT(buffer, entity, component) macro.
+ *
+ * @param buffer The target command buffer.
+ * @param entity The target entity.
+ * @param component The component to remove.
+ */
+void ecs_command_buffer_remove_component(ecs_command_buffer_t* buffer, entity_t entity, ecs_component_id component);
+/**
+ * @brief Records setting the value of a component, adding it to the entity if needed. The value is copied into the buffer. Should be accessed via the ECS_COMMAND_BUFFER_SET_COMPONENT(buffer, entity, component, value) macro.
+ *
+ * @param buffer The target command buffer.
+ * @param entity The target entity.
+ * @param component The component to set.
+ * @param data A pointer to the component value.
+ * @param stride The stride of the component.
+ */
+void ecs_command_buffer_set_component(ecs_command_buffer_t* buffer, entity_t entity, ecs_component_id component, const void* data, u32 stride);
+/**
+ * @brief Applies and clears all recorded commands. Commands are sorted by entity and coalesced, so each entity moves between archetypes at most once.
+ * Entities moving to the same archetype are moved together after the archetype's storage has been grown once.
+ *
+ * @param buffer The command buffer to flush.
+ * @param world The world to apply the commands to.
+ */
+void ecs_command_buffer_flush(ecs_command_buffer_t* buffer, struct ecs_world* world);
+
+#define ECS_COMMAND_BUFFER_SET_COMPONENT(buffer, entity, component, component_value) \
+{ \
+    component __val__ = (component)component_value; \
+    ecs_command_buffer_set_component(buffer, entity, ECS_COMPONENT_ID(component), &__val__, sizeof(component)); \
+}
+#define ECS_COMMAND_BUFFER_ADD_COMPONENT(buffer, entity, component) \
+    ecs_command_buffer_add_component(buffer, entity, ECS_COMPONENT_ID(component))
+#define ECS_COMMAND_BUFFER_REMOVE_COMPONENT(buffer, entity, component) \
+    ecs_command_buffer_remove_component(buffer, entity, ECS_COMPONENT_ID(component))
@@ -5,9 +5,16 @@
 
 #pragma once
 
+#include "OECS/core/job_system.h"
 #include "OECS/ecs/ecs.h"
+#include "OECS/ecs/ecs_command_buffer.h"
 #include "OECS/memory/linear_allocator.h"
 
+/**
+ * @brief A chunk size that keeps a chunk of every column well within a core's L1 and L2 cache.
+ */
+#define ECS_DEFAULT_CHUNK_SIZE (16 * 1024)
+
 /**
  * @class ecs_world
  * @brief A private container for all data contained by the ecs.
@@ -15,29 +22,69 @@
  */
 typedef struct ecs_world {
     /**
-     * @brief Number of entities inside of a world.
+     * @brief Number of living entities inside of a world.
      */
     entity_t entity_count;
     /**
      * @brief A lookup table to match an entity to its archetype and index.
      */
     darray_entity_record_t records;
+    /**
+     * @brief Indices of records belonging to destroyed entities. Reused by entity_create before new records are added.
+     */
+    darray_u32_t free_entity_indices;
     /**
      * @brief All defined component data.
      */
     darray_ecs_component_t components;
+    /**
+     * @brief The ids of all ECS_STORAGE_SPARSE components. Destroyed entities are removed from each of their sparse sets.
+     */
+    darray_u32_t sparse_components;
     /**
      * @brief All existing archetypes.
      */
     darray_entity_archetype_t archetypes;
     /**
-     * @brief All existing queries.
+     * @brief Maps the hash of an archetype's signature to the id of the first archetype with that hash.
+     */
+    ecs_signature_map_t archetype_map;
+    /**
+     * @brief Stamped on component rows when they are written. Advanced every time a query with changed components is iterated.
+     */
+    atomic_uint change_tick;
+    /**
+     * @brief The size in bytes of a chunk of archetype storage. Zero if archetypes store their columns contiguously.
+     */
+    u32 chunk_size;
+    /**
+     * @brief All existing queries. Queries are allocated individually so pointers to them stay valid.
+     */
+    darray_ecs_query_ptr_t queries;
+    /**
+     * @brief Queries that do not require any component stored in archetypes, such as queries of only sparse components. Matched against every new archetype.
+     */
+    darray_ecs_query_ptr_t unindexed_queries;
+    /**
+     * @brief Maps a query's hash to the first query with that hash.
      */
-    darray_ecs_query_t queries;
+    ecs_query_map_t query_map;
     /**
      * @brief An array of darrays of systems. The key to each array is an ecs_phase which allows systems to be run in a specific order.
      */
     darray_ecs_system_t systems[ECS_PHASE_ENUM_MAX];
+    /**
+     * @brief The batches systems in each phase are run in. Rebuilt whenever a system is added to a phase.
+     */
+    ecs_schedule_t schedules[ECS_PHASE_ENUM_MAX];
+    /**
+     * @brief Worker threads used to run non-conflicting systems in parallel.
+     */
+    job_system_t job_system;
+    /**
+     * @brief One command buffer per job system thread, indexed by job_system_thread_index. Flushed at the end of every phase.
+     */
+    ecs_command_buffer_t* command_buffers;
 } ecs_world_t;
 
 /**
@@ -57,20 +104,141 @@ struct ecs_world* ecs_world_get();
  */
 void ecs_world_shutdown(ecs_world_t* world);
 /**
- * @brief Runs all systems in a world.
+ * @brief Runs all systems in a world. Systems within a phase that do not conflict are run in parallel on the world's job system, and every phase finishes before the next one starts.
+ * Commands recorded by systems are flushed at the end of each phase.
  *
  * @param world The world to progress all systems.
  */
 void ecs_world_progress(ecs_world_t* world);
 
+/**
+ * @brief Returns the command buffer of the calling thread.
+ *
+ * @param world The target world.
+ */
+ecs_command_buffer_t* ecs_world_get_command_buffer(ecs_world_t* world);
+/**
+ * @brief Applies the commands recorded in every thread's command buffer. Must not be called while a query is being iterated.
+ *
+ * @param world The target world.
+ */
+void ecs_world_flush_commands(ecs_world_t* world);
+
+/**
+ * @brief Returns the change tick that writes to components are currently stamped with.
+ *
+ * @param world The target world.
+ */
+u32 ecs_world_get_change_tick(ecs_world_t* world);
+/**
+ * @brief Sets the number of job system workers that run systems and parallel queries. The world starts with one worker per hardware thread other than the calling thread.
+ * Restarts the job system and recreates the per-thread command buffers after flushing them. Must not be called while the world is progressing.
+ *
+ * @param world The target world.
+ * @param worker_count The number of worker threads. Zero runs every job on the calling thread.
+ */
+void ecs_world_set_worker_count(ecs_world_t* world, u32 worker_count);
+/**
+ * @brief Switches archetypes created from now on to chunked storage. Each chunk holds chunk_size bytes across all of an archetype's columns, so growing an archetype never copies existing components and pointers to them stay valid.
+ * Should be called before any components are added to entities.
+ *
+ * @param world The target world.
+ * @param chunk_size The size of a chunk in bytes, such as ECS_DEFAULT_CHUNK_SIZE. Zero stores columns contiguously.
+ */
+void ecs_world_set_chunk_size(ecs_world_t* world, u32 chunk_size);
+
 /**
  * @brief Defines a component for a world. Should be called via the ECS_COMPONENT_DEFINE macro to automatically get type information.
  *
  * @param world The target world.
  * @param name The name of the component.
- * @param stride The stride of the component.
+ * @param stride The stride of the component. A stride of zero defines a tag, which is part of archetype signatures and queries but has no data and no column.
+ * @param alignment The alignment of the component. Must be a power of two.
+ * @param storage Where the component's data is stored.
  * @return An id / index into the world's componet data array.
  */
-ecs_component_id ecs_world_component_define(ecs_world_t* world, const char* name, u32 stride);
+ecs_component_id ecs_world_component_define(ecs_world_t* world, const char* name, u32 stride, u32 alignment, ecs_storage_kind_t storage);
+
+#define ECS_COMPONENT_DEFINE(world, component) ECS_COMPONENT_ID(component) = ecs_world_component_define(world, "ECSComponent_" #component "_ID", sizeof(component), _Alignof(component), ECS_STORAGE_TABLE)
+#define ECS_TAG_DEFINE(world, tag) ECS_COMPONENT_ID(tag) = ecs_world_component_define(world, "ECSComponent_" #tag "_ID", 0, 1, ECS_STORAGE_TABLE)
+#define ECS_COMPONENT_DEFINE_SPARSE(world, component) ECS_COMPONENT_ID(component) = ecs_world_component_define(world, "ECSComponent_" #component "_ID", sizeof(component), _Alignof(component), ECS_STORAGE_SPARSE)
+
+/**
+ * @brief Sets the value of a world resource, creating it if needed. A resource is a single instance of a component that belongs to the world instead of an entity, such as time, input or configuration.
+ * Should be accessed via the ECS_WORLD_SET_RESOURCE(world, component, value) macro.
+ *
+ * @param world The target world.
+ * @param component The component the resource is an instance of. Tags cannot be resources.
+ * @param data A pointer to the new value, or NULL to zero the resource.
+ * @param stride The stride of the component.
+ * @return A pointer to the resource. It stays valid until the resource is removed or the world is shut down.
+ */
+void* ecs_world_set_resource(ecs_world_t* world, ecs_component_id component, const void* data, u32 stride);
+/**
+ * @brief Removes a world resource. Does nothing if the world has no resource of the component.
+ *
+ * @param world The target world.
+ * @param component The component of the resource.
+ */
+void ecs_world_remove_resource(ecs_world_t* world, ecs_component_id component);
+/**
+ * @brief Gets a world resource in constant time. Should be accessed via the ECS_WORLD_GET_RESOURCE(world, component) macro.
+ * Systems that use a resource should list it in their create info's resources so they are scheduled correctly.
+ *
+ * @param world The target world.
+ * @param component The component of the resource.
+ * @return A pointer to the resource, or NULL if it has not been set.
+ */
+SINLINE void* ecs_world_get_resource(ecs_world_t* world, ecs_component_id component) {
+    return world->components.data[component].resource;
+}
+
+#define ECS_WORLD_SET_RESOURCE(world, component, component_value) \
+{ \
+    component __val__ = (component)component_value; \
+    ecs_world_set_resource(world, ECS_COMPONENT_ID(component), &__val__, sizeof(component)); \
+}
+#define ECS_WORLD_GET_RESOURCE(world, component) \
+    ((component*)ecs_world_get_resource(world, ECS_COMPONENT_ID(component)))
+#define ECS_WORLD_REMOVE_RESOURCE(world, component) \
+    ecs_world_remove_resource(world, ECS_COMPONENT_ID(component))
+
+/**
+ * @brief Declares every component of a project at compile time. The registry is an X-macro that lists each component once:
+ *
+ *     #define GAME_COMPONENTS(COMPONENT, SPARSE, TAG) \
+ *         COMPONENT(position_t) \
+ *         COMPONENT(velocity_t) \
+ *         SPARSE(stunned_t) \
+ *         TAG(enemy)
+ *     ECS_STATIC_COMPONENTS(GAME_COMPONENTS)
+ *
+ * Each ECS_COMPONENT_ID(component) becomes an enum constant instead of a global, so component ids, query term lists and signatures can be folded by the compiler.
+ * Static components replace ECS_COMPONENT_DECLARE and ECS_COMPONENT_DEFINE, and are defined by calling the generated ecs_world_register_static_components(world)
+ * right after ecs_world_initialize, before any other component is defined. Only one registry can be used per program.
+ */
+#define ECS_STATIC_COMPONENTS(registry) \
+    enum { \
+        /* Id 0 is the world's null component */ \
+        ECS_STATIC_COMPONENTS_BEGIN = 0, \
+        registry(ECS_STATIC_COMPONENT_ENUM_, ECS_STATIC_COMPONENT_ENUM_, ECS_STATIC_COMPONENT_ENUM_) \
+        ECS_STATIC_COMPONENTS_END \
+    }; \
+    STATIC_ASSERT(ECS_STATIC_COMPONENTS_END <= ECS_MAX_COMPONENT_COUNT, "Too many static components."); \
+    SINLINE void ecs_world_register_static_components(ecs_world_t* world) { \
+        SASSERT(world->components.count == ECS_STATIC_COMPONENTS_BEGIN + 1, "Static components must be registered before any other component is defined."); \
+        registry(ECS_STATIC_COMPONENT_REGISTER_, ECS_STATIC_SPARSE_REGISTER_, ECS_STATIC_TAG_REGISTER_) \
+    }
 
-#define ECS_COMPONENT_DEFINE(world, component) ECS_COMPONENT_ID(component) = ecs_world_component_define(world, "ECSComponent_" #component "_ID", sizeof(component))
+// Helpers for ECS_STATIC_COMPONENTS
+#define ECS_STATIC_COMPONENT_ENUM_(component) ECS_COMPONENT_ID(component),
+// The component is defined outside of SASSERT so it is still registered if asserts are compiled out
+#define ECS_STATIC_DEFINE_(component, stride, alignment, storage) \
+    { \
+        ecs_component_id ecs_static_id = ecs_world_component_define(world, "ECSComponent_" #component "_ID", stride, alignment, storage); \
+        SASSERT(ecs_static_id == ECS_COMPONENT_ID(component), "Static component '" #component "' was not given its static id."); \
+        (void)ecs_static_id; \
+    }
+#define ECS_STATIC_COMPONENT_REGISTER_(component) ECS_STATIC_DEFINE_(component, sizeof(component), _Alignof(component), ECS_STORAGE_TABLE)
+#define ECS_STATIC_SPARSE_REGISTER_(component) ECS_STATIC_DEFINE_(component, sizeof(component), _Alignof(component), ECS_STORAGE_SPARSE)
+#define ECS_STATIC_TAG_REGISTER_(tag) ECS_STATIC_DEFINE_(tag, 0, 1, ECS_STORAGE_TABLE)
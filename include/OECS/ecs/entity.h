@@ -11,11 +11,26 @@
 #include "OECS/containers/darray.h"
 
 typedef u64 ecs_index;
+/**
+ * @brief An entity handle. The low 32 bits are an index into the world's records and the high 32 bits are the generation of that index.
+ * The generation is incremented every time an entity is destroyed, so handles to destroyed entities can be detected even after the index is reused.
+ */
 typedef ecs_index entity_t;
 typedef u32 ecs_component_id;
 
 darray_header(entity_t, entity);
 
+#define ENTITY_INDEX_MASK 0xFFFFFFFFULL
+#define ENTITY_GENERATION_SHIFT 32
+#define ENTITY_INDEX(entity) ((u32)((entity) & ENTITY_INDEX_MASK))
+#define ENTITY_GENERATION(entity) ((u32)((entity) >> ENTITY_GENERATION_SHIFT))
+#define ENTITY_MAKE(index, generation) ((((entity_t)(generation)) << ENTITY_GENERATION_SHIFT) | ((entity_t)(index) & ENTITY_INDEX_MASK))
+/**
+ * @brief The lowest generation used by entities recorded in a command buffer that has not been flushed yet. The low 16 bits hold the id of the buffer that created the entity. Living entities never use these generations.
+ */
+#define ENTITY_PENDING_GENERATION 0xFFFF0000U
+#define ENTITY_IS_PENDING(entity) (ENTITY_GENERATION(entity) >= ENTITY_PENDING_GENERATION)
+
 #define ENTITY_SET_COMPONENT(world, entity, component, component_value) \
 { \
     component __val__ = (component)component_value; \
@@ -23,6 +38,10 @@ darray_header(entity_t, entity);
 } 
 #define ENTITY_ADD_COMPONENT(world, entity, component) \
     entity_add_component(world, entity, ECS_COMPONENT_ID(component))
+#define ENTITY_REMOVE_COMPONENT(world, entity, component) \
+    entity_remove_component(world, entity, ECS_COMPONENT_ID(component))
+#define ENTITY_MARK_CHANGED(world, entity, component) \
+    entity_mark_changed(world, entity, ECS_COMPONENT_ID(component))
 #define ENTITY_GET_COMPONENT(world, entity, component) \
     (component*)entity_get_component(world, entity, ECS_COMPONENT_ID(component))
 #define ENTITY_TRY_GET_COMPONENT(world, entity, component, out_value) \
@@ -40,6 +59,32 @@ typedef struct ecs_world ecs_world_t;
  * @return A new entity.
  */
 entity_t entity_create(struct ecs_world* world);
+/**
+ * @brief Creates many entities with the same components at once. The target archetype is looked up once and its storage is grown once.
+ *
+ * @param world The target world.
+ * @param count The number of entities to create.
+ * @param components The components every new entity has.
+ * @param component_count The number of components.
+ * @param initial_data One pointer per component to count contiguous values to copy into the new entities. Can be NULL, as can any of its elements, in which case the component is zeroed.
+ * @return The new entities. The pointer is into the archetype's storage and is only valid until the archetype next changes.
+ */
+const entity_t* entity_create_bulk(struct ecs_world* world, u32 count, const ecs_component_id* components, u32 component_count, const void* const* initial_data);
+/**
+ * @brief Destroys an entity and frees its components. The entity's index is recycled by a later entity_create with a new generation, so the destroyed handle stays invalid.
+ *
+ * @param world The world the entity is in.
+ * @param entity The entity to destroy.
+ */
+void entity_destroy(struct ecs_world* world, entity_t entity);
+/**
+ * @brief Checks if an entity handle refers to a living entity.
+ *
+ * @param world The world the entity is in.
+ * @param entity The entity to check.
+ * @return False if the entity was destroyed or never existed, true otherwise.
+ */
+b8 entity_is_alive(struct ecs_world* world, entity_t entity);
 /**
  * @brief Checks if an entity has a component. Should be accessed via the ENTITY_HAS_COMPONENT(world, entity, component) macro.
  *
@@ -75,6 +120,14 @@ void* entity_get_component(struct ecs_world* world, entity_t entity, ecs_index c
  * @param component_id The target component.
  */
 void entity_add_component(struct ecs_world* world, entity_t entity, ecs_component_id component_id);
+/**
+ * @brief Removes a component from an entity. Does nothing if the entity does not have the component. Should be accessed via the ENTITY_REMOVE_COMPONENT(world, entity, component) macro.
+ *
+ * @param world The world the entity is in.
+ * @param entity The target entity.
+ * @param component_id The component to remove.
+ */
+void entity_remove_component(struct ecs_world* world, entity_t entity, ecs_component_id component_id);
 /**
  * @brief Sets the value of a component for an entiy. Will add the component to an entity if it does not already have the component. Should be accessed via the ENTITY_ADD_COMPONENT(world, entity, component, value) macro.
  *
@@ -85,3 +138,34 @@ void entity_add_component(struct ecs_world* world, entity_t entity, ecs_componen
  * @param stride The stride of the component.
  */
 void entity_set_component(struct ecs_world* world, entity_t entity, ecs_component_id component, void* data, u32 stride);
+/**
+ * @brief Marks a component of an entity as changed for queries with changed components. Only needed after writing through a pointer from entity_get_component, entity_set_component marks the component itself. Should be accessed via the ENTITY_MARK_CHANGED(world, entity, component) macro.
+ *
+ * @param world The world the entity is in.
+ * @param entity The target entity.
+ * @param component The component that was written.
+ */
+void entity_mark_changed(struct ecs_world* world, entity_t entity, ecs_component_id component);
+/**
+ * @brief Enables an entity that was disabled with entity_disable. Does nothing if the entity is already enabled.
+ *
+ * @param world The world the entity is in.
+ * @param entity The entity to enable.
+ */
+void entity_enable(struct ecs_world* world, entity_t entity);
+/**
+ * @brief Disables an entity so queries skip it, without moving it to another archetype. The entity keeps its components and can still be accessed directly.
+ * Must not be called while a query is iterated in parallel.
+ *
+ * @param world The world the entity is in.
+ * @param entity The entity to disable.
+ */
+void entity_disable(struct ecs_world* world, entity_t entity);
+/**
+ * @brief Checks if an entity is enabled. Entities are enabled when they are created.
+ *
+ * @param world The world the entity is in.
+ * @param entity The entity to check.
+ * @return False if the entity was disabled with entity_disable, true otherwise.
+ */
+b8 entity_is_enabled(struct ecs_world* world, entity_t entity);
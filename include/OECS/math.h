@@ -1,2 +1,3 @@
 #pragma once
 #define smax(a, b) ((a < b) ? b : a)
+#define smin(a, b) ((a < b) ? a : b)
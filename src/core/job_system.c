@@ -0,0 +1,229 @@
+#include "OECS/core/job_system.h"
+#include "OECS/core/logging.h"
+#include "OECS/core/smemory.h"
+
+#include <sched.h>
+#include <unistd.h>
+
+// Set on worker threads only. A thread is a worker of at most one job system.
+static thread_local const job_system_t* pvt_thread_job_system = NULL;
+static thread_local u32 pvt_thread_index = 0;
+
+// Returns the queue the calling thread owns in this job system. Threads that are not one of its workers share queue 0.
+static u32 job_system_queue_index(const job_system_t* job_system) {
+    return pvt_thread_job_system == job_system ? pvt_thread_index : 0;
+}
+
+static void job_queue_create(u32 capacity, job_queue_t* out_queue) {
+    out_queue->jobs = sallocate(sizeof(job_info_t) * capacity, MEMORY_TAG_JOB);
+    out_queue->capacity = capacity;
+    out_queue->head = 0;
+    out_queue->count = 0;
+    pthread_mutex_init(&out_queue->lock, NULL);
+}
+
+static void job_queue_destroy(job_queue_t* queue) {
+    sfree(queue->jobs, sizeof(job_info_t) * queue->capacity, MEMORY_TAG_JOB);
+    queue->jobs = NULL;
+    pthread_mutex_destroy(&queue->lock);
+}
+
+// Must be called with the queue lock held
+static void job_queue_grow(job_queue_t* queue) {
+    u32 new_capacity = queue->capacity * 2;
+    job_info_t* temp = sallocate(sizeof(job_info_t) * new_capacity, MEMORY_TAG_JOB);
+
+    // Unwrap the ring buffer into the new allocation
+    for (u32 i = 0; i < queue->count; i++) {
+        temp[i] = queue->jobs[(queue->head + i) % queue->capacity];
+    }
+    sfree(queue->jobs, sizeof(job_info_t) * queue->capacity, MEMORY_TAG_JOB);
+
+    queue->jobs = temp;
+    queue->capacity = new_capacity;
+    queue->head = 0;
+}
+
+static void job_queue_push_back(job_queue_t* queue, job_info_t job) {
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count >= queue->capacity) {
+        job_queue_grow(queue);
+    }
+
+    queue->jobs[(queue->head + queue->count) % queue->capacity] = job;
+    queue->count++;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// Used by the owning thread. Taking the most recently pushed job keeps its data warm in cache.
+static b8 job_queue_pop_back(job_queue_t* queue, job_info_t* out_job) {
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count == 0) {
+        pthread_mutex_unlock(&queue->lock);
+        return false;
+    }
+
+    queue->count--;
+    *out_job = queue->jobs[(queue->head + queue->count) % queue->capacity];
+    pthread_mutex_unlock(&queue->lock);
+    return true;
+}
+
+// Used by other threads to steal the oldest job
+static b8 job_queue_pop_front(job_queue_t* queue, job_info_t* out_job) {
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count == 0) {
+        pthread_mutex_unlock(&queue->lock);
+        return false;
+    }
+
+    *out_job = queue->jobs[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    pthread_mutex_unlock(&queue->lock);
+    return true;
+}
+
+static b8 job_system_take(job_system_t* job_system, u32 thread_index, job_info_t* out_job) {
+    if (atomic_load_explicit(&job_system->pending, memory_order_acquire) == 0) {
+        return false;
+    }
+
+    const u32 queue_count = job_system->thread_count + 1;
+    b8 found = job_queue_pop_back(&job_system->queues[thread_index], out_job);
+    for (u32 i = 1; i < queue_count && !found; i++) {
+        found = job_queue_pop_front(&job_system->queues[(thread_index + i) % queue_count], out_job);
+    }
+
+    if (found) {
+        atomic_fetch_sub_explicit(&job_system->pending, 1, memory_order_relaxed);
+    }
+    return found;
+}
+
+static void job_execute(job_info_t* job) {
+    job->function(job->data);
+    if (job->counter) {
+        atomic_fetch_sub_explicit(&job->counter->remaining, 1, memory_order_release);
+    }
+}
+
+static void* job_worker_run(void* data) {
+    job_worker_t* worker = data;
+    job_system_t* job_system = worker->job_system;
+    pvt_thread_job_system = job_system;
+    pvt_thread_index = worker->index;
+
+    while (atomic_load_explicit(&job_system->running, memory_order_acquire)) {
+        job_info_t job;
+        if (job_system_take(job_system, worker->index, &job)) {
+            job_execute(&job);
+            continue;
+        }
+
+        pthread_mutex_lock(&job_system->sleep_lock);
+        while (atomic_load(&job_system->running) && atomic_load(&job_system->pending) == 0) {
+            pthread_cond_wait(&job_system->job_available, &job_system->sleep_lock);
+        }
+        pthread_mutex_unlock(&job_system->sleep_lock);
+    }
+
+    return NULL;
+}
+
+void job_system_create(u32 thread_count, job_system_t* out_job_system) {
+    out_job_system->thread_count = thread_count;
+    out_job_system->workers = NULL;
+    out_job_system->owner = pthread_self();
+    atomic_init(&out_job_system->pending, 0);
+    atomic_init(&out_job_system->running, true);
+
+    pthread_mutex_init(&out_job_system->sleep_lock, NULL);
+    pthread_cond_init(&out_job_system->job_available, NULL);
+
+    out_job_system->queues = sallocate(sizeof(job_queue_t) * (thread_count + 1), MEMORY_TAG_JOB);
+    for (u32 i = 0; i < thread_count + 1; i++) {
+        job_queue_create(JOB_SYSTEM_INITIAL_CAPACITY, &out_job_system->queues[i]);
+    }
+
+    if (thread_count == 0) {
+        return;
+    }
+
+    out_job_system->workers = sallocate(sizeof(job_worker_t) * thread_count, MEMORY_TAG_THREAD);
+    for (u32 i = 0; i < thread_count; i++) {
+        job_worker_t* worker = &out_job_system->workers[i];
+        worker->job_system = out_job_system;
+        worker->index = i + 1;
+        if (pthread_create(&worker->thread, NULL, job_worker_run, worker) != 0) {
+            SCRITICAL("Failed to create job system worker thread %d", i);
+        }
+    }
+}
+
+void job_system_destroy(job_system_t* job_system) {
+    pthread_mutex_lock(&job_system->sleep_lock);
+    atomic_store(&job_system->running, false);
+    pthread_cond_broadcast(&job_system->job_available);
+    pthread_mutex_unlock(&job_system->sleep_lock);
+
+    for (u32 i = 0; i < job_system->thread_count; i++) {
+        pthread_join(job_system->workers[i].thread, NULL);
+    }
+
+    if (job_system->workers) {
+        sfree(job_system->workers, sizeof(job_worker_t) * job_system->thread_count, MEMORY_TAG_THREAD);
+        job_system->workers = NULL;
+    }
+    for (u32 i = 0; i < job_system->thread_count + 1; i++) {
+        job_queue_destroy(&job_system->queues[i]);
+    }
+    sfree(job_system->queues, sizeof(job_queue_t) * (job_system->thread_count + 1), MEMORY_TAG_JOB);
+    job_system->queues = NULL;
+
+    pthread_cond_destroy(&job_system->job_available);
+    pthread_mutex_destroy(&job_system->sleep_lock);
+}
+
+void job_system_submit(job_system_t* job_system, job_info_t job) {
+    SASSERT(job.function, "Cannot submit job without a function");
+    if (job.counter) {
+        atomic_fetch_add_explicit(&job.counter->remaining, 1, memory_order_relaxed);
+    }
+
+    u32 thread_index = job_system_queue_index(job_system);
+    // Count the job before it becomes visible so pending never drops below the number of queued jobs
+    atomic_fetch_add_explicit(&job_system->pending, 1, memory_order_release);
+    job_queue_push_back(&job_system->queues[thread_index], job);
+
+    pthread_mutex_lock(&job_system->sleep_lock);
+    pthread_cond_signal(&job_system->job_available);
+    pthread_mutex_unlock(&job_system->sleep_lock);
+}
+
+void job_system_wait(job_system_t* job_system, job_counter_t* counter) {
+    u32 thread_index = job_system_queue_index(job_system);
+    while (atomic_load_explicit(&counter->remaining, memory_order_acquire) > 0) {
+        job_info_t job;
+        if (job_system_take(job_system, thread_index, &job)) {
+            job_execute(&job);
+        } else {
+            // Remaining jobs are in flight on other threads
+            sched_yield();
+        }
+    }
+}
+
+u32 job_system_thread_index(const job_system_t* job_system) {
+    if (pvt_thread_job_system == job_system) {
+        return pvt_thread_index;
+    }
+
+    SASSERT(pthread_equal(pthread_self(), job_system->owner), "Only the thread that created a job system or one of its workers has a thread index in it.");
+    return 0;
+}
+
+u32 job_system_hardware_thread_count() {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (u32)count : 1;
+}
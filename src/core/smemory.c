@@ -7,7 +7,9 @@
 #include "OECS/containers/generic/darray_ints.h"
 #include "OECS/core/sstring.h"
 #include <execinfo.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 
@@ -27,14 +29,19 @@ typedef struct allocation_info {
 darray_type(allocation_info_t, allocation_info);
 darray_impl(allocation_info_t, allocation_info);
 
+#include <pthread.h>
+
+// Allocations can come from job system workers, so the tracked allocation list is guarded by a lock
+static pthread_mutex_t tracking_lock = PTHREAD_MUTEX_INITIALIZER;
 u32 allocation_count = 0;
 u32 allocation_capacity = 0;
 allocation_info_t* tracked_allocations = NULL;
 #endif
 
+// Atomic so that job system workers can allocate and free concurrently
 typedef struct {
-    u64 total_allocated;
-    u64 tagged_allocations[MEMORY_TAG_MAX];
+    _Atomic u64 total_allocated;
+    _Atomic u64 tagged_allocations[MEMORY_TAG_MAX];
 } memory_stats_t;
 
 const char* memory_tag_strings[] = {
@@ -127,8 +134,8 @@ pvt_sallocate(u64 size, memory_tag_t tag) {
     }
 
     if (state_ptr) {
-        state_ptr->stats.total_allocated += size;
-        state_ptr->stats.tagged_allocations[tag] += size;
+        atomic_fetch_add_explicit(&state_ptr->stats.total_allocated, size, memory_order_relaxed);
+        atomic_fetch_add_explicit(&state_ptr->stats.tagged_allocations[tag], size, memory_order_relaxed);
     }
 
     void* block = malloc(size);
@@ -136,6 +143,48 @@ pvt_sallocate(u64 size, memory_tag_t tag) {
     return block;
 }
 
+/**
+ * @brief Allocates [size] bytes of zeroed memory aligned to [alignment] bytes and tracks the number of bytes used.
+ *
+ * @param size 
+ * @param alignment Must be a power of two.
+ * @param tag 
+ */
+void*  
+pvt_sallocate_aligned(u64 size, u64 alignment, memory_tag_t tag) {
+    if (size == 0) {
+        SERROR("Cannot allocate zero bytes of memory");
+        return NULL;
+    }
+    SASSERT(alignment != 0 && (alignment & (alignment - 1)) == 0, "Cannot allocate memory with an alignment of %lu, alignment must be a power of two.", alignment);
+
+    if (tag == MEMORY_TAG_UNDEFINED) {
+        SWARN("Allocating %lu bytes to undefined memory tag.", size);
+    }
+
+    // aligned_alloc requires the size to be a multiple of the alignment
+    alignment = alignment < sizeof(void*) ? sizeof(void*) : alignment;
+    const u64 aligned_size = (size + alignment - 1) & ~(alignment - 1);
+    if (aligned_size < size) {
+        SERROR("Cannot allocate %lu bytes aligned to %lu bytes, the padded size overflows", size, alignment);
+        return NULL;
+    }
+
+    void* block = aligned_alloc(alignment, aligned_size);
+    if (block == NULL) {
+        SERROR("Failed to allocate %lu bytes of memory aligned to %lu bytes", aligned_size, alignment);
+        return NULL;
+    }
+    memset(block, 0, size);
+
+    // Tracked after the allocation succeeds so a failed allocation is never counted
+    if (state_ptr) {
+        atomic_fetch_add_explicit(&state_ptr->stats.total_allocated, size, memory_order_relaxed);
+        atomic_fetch_add_explicit(&state_ptr->stats.tagged_allocations[tag], size, memory_order_relaxed);
+    }
+    return block;
+}
+
 /**
  * @brief Frees memory [block] and tracks the number of bytes freed
  *
@@ -150,12 +199,12 @@ pvt_spark_free(const void* block, u64 size, memory_tag_t tag) {
     }
 
     if (state_ptr) {
-        if (state_ptr->stats.tagged_allocations[tag] - size > state_ptr->stats.tagged_allocations[tag]) {
-            SCRITICAL("Underflowed a memory allocation tag by freeing %lu bytes. Before %lu, After %lu - Failed to free the correct type of memory '%s'", size, state_ptr->stats.tagged_allocations[tag], state_ptr->stats.tagged_allocations[tag] - size, memory_tag_strings[tag]);
+        u64 before = atomic_fetch_sub_explicit(&state_ptr->stats.tagged_allocations[tag], size, memory_order_relaxed);
+        if (before < size) {
+            SCRITICAL("Underflowed a memory allocation tag by freeing %lu bytes. Before %lu, After %lu - Failed to free the correct type of memory '%s'", size, before, before - size, memory_tag_strings[tag]);
         } 
 
-        state_ptr->stats.total_allocated -= size;
-        state_ptr->stats.tagged_allocations[tag] -= size;
+        atomic_fetch_sub_explicit(&state_ptr->stats.total_allocated, size, memory_order_relaxed);
     }
 
     free((void*)block);
@@ -237,10 +286,10 @@ char* get_memory_usage_string() {
 
     strcpy(memory_usage_string, "System memory use (tagged):\n");
     u64 offset = strlen(memory_usage_string);
-    copy_memory_usage_string(memory_usage_string, "TOTAL              ", state_ptr->stats.total_allocated, &offset);
+    copy_memory_usage_string(memory_usage_string, "TOTAL              ", atomic_load_explicit(&state_ptr->stats.total_allocated, memory_order_relaxed), &offset);
 
     for (int i = 0; i < MEMORY_TAG_MAX; i++) {
-        u64 size = state_ptr->stats.tagged_allocations[i];
+        u64 size = atomic_load_explicit(&state_ptr->stats.tagged_allocations[i], memory_order_relaxed);
         copy_memory_usage_string(memory_usage_string, memory_tag_strings[i], size, &offset);
     }
 
@@ -295,6 +344,7 @@ create_tracked_allocation(u64 size, memory_tag_t tag, const char* file, u32 line
         .backtrace = backtrace_string,
     };
 
+    pthread_mutex_lock(&tracking_lock);
     if (tracked_allocations) {
         // Ensure that the darray doesnt try to allocate itself in an infinite loop by managing it here
         if (allocation_count >= allocation_capacity) {
@@ -308,6 +358,7 @@ create_tracked_allocation(u64 size, memory_tag_t tag, const char* file, u32 line
 
         tracked_allocations[allocation_count++] = info;
     }
+    pthread_mutex_unlock(&tracking_lock);
 
     return block;
 }
@@ -315,6 +366,7 @@ create_tracked_allocation(u64 size, memory_tag_t tag, const char* file, u32 line
 void 
 free_tracked_allocation(const void* block, u32 size, memory_tag_t tag) {
     // Find the allocation by its block
+    pthread_mutex_lock(&tracking_lock);
     for (int i = 0; i < allocation_count; i++) {
         if (tracked_allocations[i].block == block) {
             SASSERT(tracked_allocations[i].tag == tag,  "Trying to free allocation with different memory tag than it was initialized with.\n\t\t"
@@ -331,6 +383,7 @@ free_tracked_allocation(const void* block, u32 size, memory_tag_t tag) {
             allocation_count--;
         }
     }
+    pthread_mutex_unlock(&tracking_lock);
 
     pvt_spark_free(block, size, tag);
 }
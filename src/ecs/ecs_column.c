@@ -3,14 +3,66 @@
 #include "OECS/ecs/ecs.h"
 #include "OECS/math.h"
 
-void ecs_component_column_create(u32 initial_count, u32 component_stride, ecs_column_t* out_column) {
-    out_column->data = sallocate(initial_count * component_stride, MEMORY_TAG_ECS);
+void ecs_component_column_create(u32 initial_count, u32 component_stride, u32 component_alignment, u32 chunk_row_count, ecs_column_t* out_column) {
+    out_column->alignment = smax(component_alignment, ECS_COLUMN_ALIGNMENT);
     out_column->count = 0;
-    out_column->capacity = initial_count;
+    out_column->capacity = 0;
     out_column->component_stride = component_stride;
+    out_column->chunk_row_count = chunk_row_count;
+    // Ticks follow the rows of a chunk, aligned for u32
+    out_column->chunk_ticks_offset = (chunk_row_count * component_stride + sizeof(u32) - 1) & ~(sizeof(u32) - 1);
+    out_column->data = NULL;
+    out_column->chunks = NULL;
+    out_column->change_ticks = NULL;
+    out_column->max_change_tick = 0;
+
+    // Zero size columns only track change ticks
+    if (chunk_row_count > 0 || component_stride == 0) {
+        ecs_component_column_resize(out_column, initial_count);
+        return;
+    }
+
+    out_column->data = sallocate_aligned(initial_count * component_stride, out_column->alignment, MEMORY_TAG_ECS);
+    out_column->change_ticks = sallocate(sizeof(u32) * initial_count, MEMORY_TAG_ECS);
+    out_column->capacity = initial_count;
+}
+
+// The size in bytes of a chunk, including its change ticks and their maximum
+static u64 ecs_component_column_chunk_size(const ecs_column_t* column) {
+    return column->chunk_ticks_offset + sizeof(u32) * (column->chunk_row_count + 1);
+}
+
+// The chunk pointer array grows geometrically, so its capacity is the chunk count rounded up to a power of two
+static u32 ecs_component_column_chunk_array_capacity(u32 chunk_count) {
+    u32 capacity = 1;
+    while (capacity < chunk_count) {
+        capacity *= 2;
+    }
+    return capacity;
 }
 
 void ecs_component_column_destroy(ecs_column_t* column) {
+    if (column->chunk_row_count > 0) {
+        u32 chunk_count = column->capacity / column->chunk_row_count;
+        for (u32 i = 0; i < chunk_count; i++) {
+            sfree(column->chunks[i], ecs_component_column_chunk_size(column), MEMORY_TAG_ECS);
+        }
+        if (column->chunks) {
+            sfree(column->chunks, sizeof(void*) * ecs_component_column_chunk_array_capacity(chunk_count), MEMORY_TAG_ECS);
+        }
+        szero_memory(column, sizeof(ecs_column_t));
+        return;
+    }
+
+    if (column->change_ticks) {
+        sfree(column->change_ticks, sizeof(u32) * column->capacity, MEMORY_TAG_ECS);
+    }
+
+    if (column->component_stride == 0) {
+        szero_memory(column, sizeof(ecs_column_t));
+        return;
+    }
+
     if (!column->data) {
         SWARN("Trying to free null column data");
         return;
@@ -20,16 +72,68 @@ void ecs_component_column_destroy(ecs_column_t* column) {
     szero_memory(column, sizeof(ecs_column_t));
 }
 
-void ecs_component_column_resize(ecs_column_t* column, u32 size) { 
+// Must be called before column->capacity is updated
+static void ecs_component_column_resize_change_ticks(ecs_column_t* column, u32 size) {
+    u32* temp = sallocate(sizeof(u32) * size, MEMORY_TAG_ECS);
+    if (column->change_ticks) {
+        scopy_memory(temp, column->change_ticks, sizeof(u32) * column->count);
+        sfree(column->change_ticks, sizeof(u32) * column->capacity, MEMORY_TAG_ECS);
+    }
+    column->change_ticks = temp;
+}
+
+// Adds chunks until the column can hold size rows. Each chunk holds its rows followed by their change ticks.
+// Existing chunks are never moved, only the array of chunk pointers is copied when it runs out of room.
+static void ecs_component_column_resize_chunked(ecs_column_t* column, u32 size) {
+    u32 chunk_count = column->capacity / column->chunk_row_count;
+    u32 new_chunk_count = (size + column->chunk_row_count - 1) / column->chunk_row_count;
+    if (new_chunk_count <= chunk_count) {
+        return;
+    }
+
+    u32 array_capacity = ecs_component_column_chunk_array_capacity(chunk_count);
+    if (!column->chunks || new_chunk_count > array_capacity) {
+        u32 new_array_capacity = ecs_component_column_chunk_array_capacity(new_chunk_count);
+        void** temp = sallocate(sizeof(void*) * new_array_capacity, MEMORY_TAG_ECS);
+        if (column->chunks) {
+            scopy_memory(temp, column->chunks, sizeof(void*) * chunk_count);
+            sfree(column->chunks, sizeof(void*) * array_capacity, MEMORY_TAG_ECS);
+        }
+        column->chunks = temp;
+    }
+
+    for (u32 i = chunk_count; i < new_chunk_count; i++) {
+        column->chunks[i] = sallocate_aligned(ecs_component_column_chunk_size(column), column->alignment, MEMORY_TAG_ECS);
+    }
+
+    column->capacity = new_chunk_count * column->chunk_row_count;
+}
+
+void ecs_component_column_resize(ecs_column_t* column, u32 size) {
+    if (column->chunk_row_count > 0) {
+        ecs_component_column_resize_chunked(column, size);
+        return;
+    }
+
+    if (column->component_stride == 0) {
+        if (size > column->capacity) {
+            ecs_component_column_resize_change_ticks(column, size);
+            column->capacity = size;
+        }
+        return;
+    }
+
     if (!column->data && size > 0) {
-        column->data = sallocate(column->component_stride * size, MEMORY_TAG_ECS);
+        column->data = sallocate_aligned(column->component_stride * size, column->alignment, MEMORY_TAG_ECS);
+        ecs_component_column_resize_change_ticks(column, size);
+        column->capacity = size;
         return;
     }
 
     if (size > column->capacity) {
         SASSERT(column->component_stride > 0, "Resizing component column with component size of 0 is not allowed.");
         SASSERT(column->count >= 0 && column->count != INVALID_ID_U64, "Cannot resize column with negative number of elements: %d", column->count);
-        void* temp = sallocate(column->component_stride * size, MEMORY_TAG_ECS);
+        void* temp = sallocate_aligned(column->component_stride * size, column->alignment, MEMORY_TAG_ECS);
 
         // Zero out new memory
         sset_memory(temp + column->count * column->component_stride, 0, (size - column->count) * column->component_stride);
@@ -37,30 +141,57 @@ void ecs_component_column_resize(ecs_column_t* column, u32 size) {
         // Copy old memory
         scopy_memory(temp, column->data, column->count * column->component_stride);
         sfree(column->data, column->capacity * column->component_stride, MEMORY_TAG_ECS);
+        ecs_component_column_resize_change_ticks(column, size);
 
         column->data = temp;
         column->capacity = size;
     }
 }
 
-void ecs_component_column_push(ecs_column_t* column, void* data) {
-    if (column->count >= column->capacity) {
-        ecs_component_column_resize(column, smax(column->capacity, 1) * 2);
+// Makes room for at least one more row. Chunked columns grow by a single chunk.
+static void ecs_component_column_grow(ecs_column_t* column) {
+    if (column->chunk_row_count > 0) {
+        ecs_component_column_resize(column, column->capacity + 1);
+        return;
     }
 
-    SASSERT(column->data, "Cannot push to empty ecs column");
+    ecs_component_column_resize(column, smax(column->capacity, 1) * ECS_COLUMN_RESIZE_FACTOR);
+}
+
+void ecs_component_column_push(ecs_column_t* column, void* data, u32 change_tick) {
     SASSERT(column, "Cannot push to null ecs column");
+    if (column->count >= column->capacity) {
+        ecs_component_column_grow(column);
+    }
 
-    scopy_memory(column->data + column->component_stride * column->count, data, column->component_stride);
+    if (column->component_stride > 0) {
+        scopy_memory(ecs_component_column_get(column, column->count), data, column->component_stride);
+    }
+    ecs_component_column_set_change_ticks(column, column->count, 1, change_tick);
+    column->count++;
+}
+
+void ecs_component_column_push_zeroed(ecs_column_t* column, u32 change_tick) {
+    if (column->count >= column->capacity) {
+        ecs_component_column_grow(column);
+    }
+
+    if (column->component_stride > 0) {
+        szero_memory(ecs_component_column_get(column, column->count), column->component_stride);
+    }
+    ecs_component_column_set_change_ticks(column, column->count, 1, change_tick);
     column->count++;
 }
 
 void ecs_component_column_pop(ecs_column_t* column, ecs_index row) {
     SASSERT(column->count != 0, "Cannot pop element from empty ecs_column.");
     // Copy last element to pop location
-    // if (row != column->count - 1) {
-        scopy_memory(column->data + column->component_stride * row, column->data + column->component_stride * (column->count - 1), column->component_stride);
-    // }
+    if (row != column->count - 1) {
+        if (column->component_stride > 0) {
+            scopy_memory(ecs_component_column_get(column, row), ecs_component_column_get(column, column->count - 1), column->component_stride);
+        }
+        ecs_component_column_set_change_ticks(column, row, 1, *ecs_component_column_get_change_tick(column, column->count - 1));
+    }
 
     column->count--;
 }
@@ -0,0 +1,314 @@
+#include "OECS/ecs/ecs_command_buffer.h"
+#include "OECS/core/smemory.h"
+#include "OECS/ecs/ecs.h"
+#include "OECS/ecs/ecs_world.h"
+#include "OECS/math.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#define ECS_COMMAND_BUFFER_INITIAL_CAPACITY 64
+
+darray_impl(ecs_command_t, ecs_command);
+
+// Buffers can be created from any thread. Ids wrap, so a handle is only checked against buffers created close to its own.
+static atomic_uint pvt_next_command_buffer_id = 0;
+
+/**
+ * @brief All commands recorded for a single entity after sorting.
+ */
+typedef struct ecs_command_group {
+    entity_t entity;
+    u32 first_command;
+    u32 command_count;
+    u32 source_archetype;
+    u32 target_archetype;
+    b8 is_destroyed;
+} ecs_command_group_t;
+
+void ecs_command_buffer_create(ecs_command_buffer_t* out_buffer) {
+    darray_ecs_command_create(ECS_COMMAND_BUFFER_INITIAL_CAPACITY, &out_buffer->commands);
+    darray_u8_create(ECS_COMMAND_BUFFER_INITIAL_CAPACITY * 16, &out_buffer->data);
+    out_buffer->pending_entity_count = 0;
+    out_buffer->id = (u16)atomic_fetch_add_explicit(&pvt_next_command_buffer_id, 1, memory_order_relaxed);
+}
+
+void ecs_command_buffer_destroy(ecs_command_buffer_t* buffer) {
+    darray_ecs_command_destroy(&buffer->commands);
+    darray_u8_destroy(&buffer->data);
+}
+
+// Pending entities can only be used with the buffer that created them, and only until it is flushed
+static void ecs_command_buffer_check_pending(const ecs_command_buffer_t* buffer, entity_t entity) {
+    SASSERT(ENTITY_GENERATION(entity) == (ENTITY_PENDING_GENERATION | buffer->id), "Pending entity 0x%lx was created by a different command buffer.", entity);
+    SASSERT(ENTITY_INDEX(entity) < buffer->pending_entity_count, "Pending entity 0x%lx was created before the command buffer was last flushed.", entity);
+}
+
+static ecs_command_t* ecs_command_buffer_push(ecs_command_buffer_t* buffer, ecs_command_type_t type, entity_t entity, ecs_component_id component) {
+    if (ENTITY_IS_PENDING(entity)) {
+        ecs_command_buffer_check_pending(buffer, entity);
+    }
+    ecs_command_t command = {
+        .entity = entity,
+        .type = type,
+        .component = component,
+        .sequence = buffer->commands.count,
+    };
+    return darray_ecs_command_push(&buffer->commands, command);
+}
+
+entity_t ecs_command_buffer_create_entity(ecs_command_buffer_t* buffer) {
+    entity_t entity = ENTITY_MAKE(buffer->pending_entity_count++, ENTITY_PENDING_GENERATION | buffer->id);
+    ecs_command_buffer_push(buffer, ECS_COMMAND_CREATE, entity, INVALID_ID);
+    return entity;
+}
+
+void ecs_command_buffer_destroy_entity(ecs_command_buffer_t* buffer, entity_t entity) {
+    ecs_command_buffer_push(buffer, ECS_COMMAND_DESTROY, entity, INVALID_ID);
+}
+
+void ecs_command_buffer_add_component(ecs_command_buffer_t* buffer, entity_t entity, ecs_component_id component) {
+    ecs_command_buffer_push(buffer, ECS_COMMAND_ADD, entity, component);
+}
+
+void ecs_command_buffer_remove_component(ecs_command_buffer_t* buffer, entity_t entity, ecs_component_id component) {
+    ecs_command_buffer_push(buffer, ECS_COMMAND_REMOVE, entity, component);
+}
+
+void ecs_command_buffer_set_component(ecs_command_buffer_t* buffer, entity_t entity, ecs_component_id component, const void* data, u32 stride) {
+    u32 data_offset = buffer->data.count;
+    if (data_offset + stride > buffer->data.capacity) {
+        darray_u8_reserve(&buffer->data, smax(buffer->data.capacity * 2, data_offset + stride));
+    }
+    darray_u8_push_range(&buffer->data, stride, data);
+
+    ecs_command_t* command = ecs_command_buffer_push(buffer, ECS_COMMAND_SET, entity, component);
+    command->data_offset = data_offset;
+    command->data_size = stride;
+}
+
+static int ecs_command_compare(const void* a, const void* b) {
+    const ecs_command_t* command_a = a;
+    const ecs_command_t* command_b = b;
+    if (command_a->entity != command_b->entity) {
+        return command_a->entity < command_b->entity ? -1 : 1;
+    }
+    return command_a->sequence < command_b->sequence ? -1 : command_a->sequence > command_b->sequence;
+}
+
+static int ecs_command_group_compare(const void* a, const void* b) {
+    const ecs_command_group_t* group_a = a;
+    const ecs_command_group_t* group_b = b;
+    if (group_a->target_archetype != group_b->target_archetype) {
+        return group_a->target_archetype < group_b->target_archetype ? -1 : 1;
+    }
+    if (group_a->source_archetype != group_b->source_archetype) {
+        return group_a->source_archetype < group_b->source_archetype ? -1 : 1;
+    }
+    return group_a->entity < group_b->entity ? -1 : group_a->entity > group_b->entity;
+}
+
+// Works out which archetype an entity ends up in once all of its commands have been applied
+static void ecs_command_group_resolve(ecs_world_t* world, ecs_command_t* commands, ecs_command_group_t* group) {
+    entity_record_t record = world->records.data[ENTITY_INDEX(group->entity)];
+    entity_archetype_t* archetype = &world->archetypes.data[record.archetype_index];
+    group->source_archetype = record.archetype_index;
+
+    ecs_component_id components[archetype->component_set.count + group->command_count];
+    u32 component_count = 0;
+    for (u32 i = 0; i < archetype->component_set.capacity; i++) {
+        if (archetype->component_set.data[i].value != INVALID_ID) {
+            components[component_count++] = archetype->component_set.data[i].value;
+        }
+    }
+
+    b8 is_changed = false;
+    for (u32 i = 0; i < group->command_count && !group->is_destroyed; i++) {
+        ecs_command_t* command = &commands[group->first_command + i];
+        // Sparse components do not affect the archetype and are applied after the move
+        if (command->component != INVALID_ID && world->components.data[command->component].storage == ECS_STORAGE_SPARSE) {
+            continue;
+        }
+
+        switch (command->type) {
+            case ECS_COMMAND_DESTROY:
+                group->is_destroyed = true;
+                break;
+            case ECS_COMMAND_ADD:
+            case ECS_COMMAND_SET: {
+                b8 has_component = false;
+                for (u32 j = 0; j < component_count && !has_component; j++) {
+                    has_component = components[j] == command->component;
+                }
+                if (!has_component) {
+                    components[component_count++] = command->component;
+                    is_changed = true;
+                }
+            } break;
+            case ECS_COMMAND_REMOVE:
+                for (u32 j = 0; j < component_count; j++) {
+                    if (components[j] == command->component) {
+                        components[j] = components[--component_count];
+                        is_changed = true;
+                        break;
+                    }
+                }
+                break;
+            case ECS_COMMAND_CREATE:
+                break;
+        }
+    }
+
+    if (group->is_destroyed || !is_changed) {
+        group->target_archetype = record.archetype_index;
+        return;
+    }
+
+    group->target_archetype = entity_archetype_get_or_create(world, component_count, components)->archetype_id;
+}
+
+// Applies component values, and adds and removes of sparse components, once the entity is in its target archetype
+static void ecs_command_group_apply_sets(ecs_command_buffer_t* buffer, ecs_world_t* world, ecs_command_t* commands, ecs_command_group_t* group) {
+    entity_record_t record = world->records.data[ENTITY_INDEX(group->entity)];
+    entity_archetype_t* archetype = &world->archetypes.data[record.archetype_index];
+
+    for (u32 i = 0; i < group->command_count; i++) {
+        ecs_command_t* command = &commands[group->first_command + i];
+        if (command->component != INVALID_ID && world->components.data[command->component].storage == ECS_STORAGE_SPARSE) {
+            // Sparse commands are applied in the order they were recorded
+            if (command->type == ECS_COMMAND_ADD) {
+                entity_add_component(world, group->entity, command->component);
+            } else if (command->type == ECS_COMMAND_REMOVE) {
+                entity_remove_component(world, group->entity, command->component);
+            } else if (command->type == ECS_COMMAND_SET) {
+                entity_set_component(world, group->entity, command->component, buffer->data.data + command->data_offset, command->data_size);
+            }
+            continue;
+        }
+
+        if (command->type != ECS_COMMAND_SET || !ecs_component_set_contains(&archetype->component_set, command->component)) {
+            continue;
+        }
+
+        // A later remove discards the value
+        b8 is_removed_later = false;
+        for (u32 j = i + 1; j < group->command_count && !is_removed_later; j++) {
+            is_removed_later = commands[group->first_command + j].type == ECS_COMMAND_REMOVE && commands[group->first_command + j].component == command->component;
+        }
+        if (is_removed_later) {
+            continue;
+        }
+
+        ecs_column_t* column = entity_archetype_get_column(archetype, command->component);
+        if (!column) {
+            continue;
+        }
+        SASSERT(column->component_stride == command->data_size, "Cannot set component '%s' with stride %d from command buffer, expected stride %d.", world->components.data[command->component].name, command->data_size, column->component_stride);
+        scopy_memory(ecs_component_column_get(column, record.index), buffer->data.data + command->data_offset, command->data_size);
+        ecs_component_column_set_change_ticks(column, record.index, 1, ecs_world_get_change_tick(world));
+    }
+}
+
+void ecs_command_buffer_flush(ecs_command_buffer_t* buffer, struct ecs_world* world) {
+    const u32 command_count = buffer->commands.count;
+    if (command_count == 0) {
+        return;
+    }
+    ecs_command_t* commands = buffer->commands.data;
+
+    // Create pending entities first so commands can refer to them
+    const u32 pending_entity_count = buffer->pending_entity_count;
+    entity_t* created_entities = NULL;
+    if (pending_entity_count > 0) {
+        created_entities = sallocate(sizeof(entity_t) * pending_entity_count, MEMORY_TAG_ECS);
+    }
+    for (u32 i = 0; i < command_count; i++) {
+        if (commands[i].type == ECS_COMMAND_CREATE) {
+            ecs_command_buffer_check_pending(buffer, commands[i].entity);
+            created_entities[ENTITY_INDEX(commands[i].entity)] = entity_create(world);
+        }
+    }
+    for (u32 i = 0; i < command_count; i++) {
+        if (ENTITY_IS_PENDING(commands[i].entity)) {
+            ecs_command_buffer_check_pending(buffer, commands[i].entity);
+            commands[i].entity = created_entities[ENTITY_INDEX(commands[i].entity)];
+        }
+    }
+    if (created_entities) {
+        sfree(created_entities, sizeof(entity_t) * pending_entity_count, MEMORY_TAG_ECS);
+    }
+
+    // Group commands by entity while keeping the order they were recorded in
+    qsort(commands, command_count, sizeof(ecs_command_t), ecs_command_compare);
+
+    ecs_command_group_t* groups = sallocate(sizeof(ecs_command_group_t) * command_count, MEMORY_TAG_ECS);
+    u32 group_count = 0;
+    for (u32 i = 0; i < command_count;) {
+        u32 first_command = i;
+        while (i < command_count && commands[i].entity == commands[first_command].entity) {
+            i++;
+        }
+
+        if (!entity_is_alive(world, commands[first_command].entity)) {
+            SWARN("Skipping %d commands for entity 0x%lx, it is not alive.", i - first_command, commands[first_command].entity);
+            continue;
+        }
+
+        ecs_command_group_t* group = &groups[group_count++];
+        group->entity = commands[first_command].entity;
+        group->first_command = first_command;
+        group->command_count = i - first_command;
+        group->is_destroyed = false;
+        ecs_command_group_resolve(world, commands, group);
+    }
+
+    // Entities moving to the same archetype are moved together so its storage only grows once
+    qsort(groups, group_count, sizeof(ecs_command_group_t), ecs_command_group_compare);
+    for (u32 i = 0; i < group_count;) {
+        u32 target_archetype = groups[i].target_archetype;
+        u32 incoming_count = 0;
+        for (; i < group_count && groups[i].target_archetype == target_archetype; i++) {
+            incoming_count += !groups[i].is_destroyed && groups[i].source_archetype != target_archetype;
+        }
+        entity_archetype_reserve(&world->archetypes.data[target_archetype], incoming_count);
+    }
+
+    // Groups are sorted by source within each target, so every pair of archetypes builds its column map once
+    u32* column_map = NULL;
+    u32 column_map_capacity = 0;
+    u32 mapped_source = INVALID_ID;
+    u32 mapped_target = INVALID_ID;
+    for (u32 i = 0; i < group_count; i++) {
+        ecs_command_group_t* group = &groups[i];
+        if (group->is_destroyed) {
+            entity_destroy(world, group->entity);
+            continue;
+        }
+
+        if (group->source_archetype != group->target_archetype) {
+            entity_archetype_t* target = &world->archetypes.data[group->target_archetype];
+            if (group->source_archetype != mapped_source || group->target_archetype != mapped_target) {
+                if (target->columns.count > column_map_capacity) {
+                    if (column_map) {
+                        sfree(column_map, sizeof(u32) * column_map_capacity, MEMORY_TAG_ECS);
+                    }
+                    column_map_capacity = target->columns.count;
+                    column_map = sallocate(sizeof(u32) * column_map_capacity, MEMORY_TAG_ECS);
+                }
+                entity_archetype_build_column_map(&world->archetypes.data[group->source_archetype], target, column_map);
+                mapped_source = group->source_archetype;
+                mapped_target = group->target_archetype;
+            }
+            entity_transition_archetype_mapped(world, group->entity, target, column_map);
+        }
+        ecs_command_group_apply_sets(buffer, world, commands, group);
+    }
+
+    if (column_map) {
+        sfree(column_map, sizeof(u32) * column_map_capacity, MEMORY_TAG_ECS);
+    }
+    sfree(groups, sizeof(ecs_command_group_t) * command_count, MEMORY_TAG_ECS);
+    darray_ecs_command_clear(&buffer->commands);
+    darray_u8_clear(&buffer->data);
+    buffer->pending_entity_count = 0;
+}
@@ -6,8 +6,10 @@ darray_impl(ecs_column_t, ecs_column);
 darray_impl(entity_record_t, entity_record);
 darray_impl(entity_archetype_t, entity_archetype);
 darray_impl(entity_archetype_t*, entity_archetype_ptr);
+darray_impl(entity_archetype_query_match_t, entity_archetype_query_match);
 darray_impl(ecs_system_t, ecs_system);
 darray_impl(ecs_component_t, ecs_component);
-hashmap_impl(ecs_component_id, entity_archetype_t*, entity_archetype_ptr_map, hash_passthrough);
+hashmap_impl(ecs_component_id, entity_archetype_edge_target_t, entity_archetype_edge_map, hash_passthrough);
+hashmap_impl(u64, u32, ecs_signature_map, hash_passthrough);
 
 darray_impl(entity_t, entity);
@@ -3,36 +3,72 @@
 #include "OECS/ecs/ecs.h"
 #include "OECS/ecs/ecs_world.h"
 #include "OECS/ecs/entity.h"
+#include "OECS/math.h"
+#include "OECS/utils/hashing.h"
+
+#include <stdlib.h>
 
 #define ECS_QUERY_INITIAL_CAPACITY 5
-darray_impl(ecs_query_t, ecs_query);
+darray_impl(ecs_query_t*, ecs_query_ptr);
+hashmap_impl(u64, ecs_query_t*, ecs_query_map, hash_passthrough);
 
-// u32 __builtin_stdc_trailing_zeros(ecs_component_id component);
-s32 sort_components(void* a, void* b) {
-    return *(ecs_component_id*)a < *(ecs_component_id*)b;
+static s32 sort_components(const void* a, const void* b) {
+    ecs_component_id component_a = *(const ecs_component_id*)a;
+    ecs_component_id component_b = *(const ecs_component_id*)b;
+    return component_a < component_b ? -1 : component_a > component_b;
 }
 
-ecs_query_t* ecs_query_create(struct ecs_world* world, const ecs_query_create_info_t* create_info) {
-    // Check if query already exists
-    const u32 max_component_count = 128;
-    u32 total_component_count = create_info->component_count + create_info->without_component_count;
-    u32 all_components[max_component_count];
+// Component order is kept since it decides the order of iterator->component_data, excluded components are expected to be sorted
+static u64 ecs_query_hash_terms(u32 component_count, const ecs_component_id* components, u32 without_component_count, const ecs_component_id* without_components) {
+    u64 hash = hash_u64(component_count) ^ (hash_u64(without_component_count) << 1);
+    for (u32 i = 0; i < component_count; i++) {
+        hash = hash_u64(hash ^ components[i]);
+    }
+    for (u32 i = 0; i < without_component_count; i++) {
+        hash = hash_u64(hash ^ (without_components[i] + ECS_MAX_COMPONENT_COUNT));
+    }
+
+    // INVALID_ID_U64 marks an empty slot in the query map
+    return hash == INVALID_ID_U64 ? 0 : hash;
+}
+
+static b8 ecs_query_terms_equal(ecs_query_t* query, u32 component_count, const ecs_component_id* components, u32 without_component_count, const ecs_component_id* without_components) {
+    if (query->components.count != component_count || query->without_components.count != without_component_count) {
+        return false;
+    }
+    for (u32 i = 0; i < component_count; i++) {
+        if (query->components.data[i] != components[i]) {
+            return false;
+        }
+    }
+    for (u32 i = 0; i < without_component_count; i++) {
+        if (query->without_components.data[i] != without_components[i]) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    scopy_memory(all_components, create_info->components, sizeof(ecs_component_id) * create_info->component_count);
-    scopy_memory(all_components + create_info->component_count, create_info->without_components, sizeof(ecs_component_id) * create_info->without_component_count);
+ecs_query_t* ecs_query_create(struct ecs_world* world, const ecs_query_create_info_t* create_info) {
+    // Iterators and row filters hold one entry per term in fixed size arrays
+    SASSERT(create_info->component_count <= MAX_QUERY_COMPONENT_COUNT, "Query has too many components: %d, max is %d", create_info->component_count, MAX_QUERY_COMPONENT_COUNT);
+    SASSERT(create_info->without_component_count <= MAX_QUERY_COMPONENT_COUNT, "Query has too many without components: %d, max is %d", create_info->without_component_count, MAX_QUERY_COMPONENT_COUNT);
+    SASSERT(create_info->changed_component_count <= MAX_QUERY_COMPONENT_COUNT, "Query has too many changed components: %d, max is %d", create_info->changed_component_count, MAX_QUERY_COMPONENT_COUNT);
 
-    u64 query_hash = 0x45d9f3bu;
-    for (u32 i = 0; i < total_component_count; i++) {
-        query_hash ^= all_components[i];
-        u32 trailing_zeros = __builtin_stdc_trailing_zeros(query_hash);
-        query_hash >>= trailing_zeros;
-        trailing_zeros ^= 0x45d9f3bu;
+    // Check if query already exists
+    ecs_component_id without_components[smax(create_info->without_component_count, 1)];
+    if (create_info->without_component_count > 0) {
+        scopy_memory(without_components, create_info->without_components, sizeof(ecs_component_id) * create_info->without_component_count);
+        qsort(without_components, create_info->without_component_count, sizeof(ecs_component_id), sort_components);
     }
 
-    // TODO: This is O(n) and slow
-    for (u32 i = 0; i < world->queries.count; i++) {
-        if (query_hash == world->queries.data[i].hash) {
-            return &world->queries.data[i];
+    // Queries with changed components track when they were last iterated, so they cannot be shared
+    const b8 is_shared = create_info->changed_component_count == 0;
+    u64 query_hash = ecs_query_hash_terms(create_info->component_count, create_info->components, create_info->without_component_count, without_components);
+    ecs_query_t** first_with_hash = is_shared ? ecs_query_map_get(&world->query_map, query_hash) : NULL;
+    for (ecs_query_t* existing = first_with_hash ? *first_with_hash : NULL; existing; existing = existing->next_with_hash) {
+        if (ecs_query_terms_equal(existing, create_info->component_count, create_info->components, create_info->without_component_count, without_components)) {
+            return existing;
         }
     }
 
@@ -42,38 +78,104 @@ ecs_query_t* ecs_query_create(struct ecs_world* world, const ecs_query_create_in
         .hash = query_hash,
     };
 
+    // Sparse components are not in any archetype's signature, so they are checked per entity while iterating
+    for (u32 i = 0; i < create_info->component_count; i++) {
+        if (world->components.data[create_info->components[i]].storage == ECS_STORAGE_TABLE) {
+            ecs_signature_add(&query.signature, create_info->components[i]);
+        }
+    }
+    for (u32 i = 0; i < create_info->without_component_count; i++) {
+        if (world->components.data[create_info->without_components[i]].storage == ECS_STORAGE_TABLE) {
+            ecs_signature_add(&query.without_signature, create_info->without_components[i]);
+        }
+    }
+    for (u32 i = 0; i < create_info->changed_component_count; i++) {
+        if (world->components.data[create_info->changed_components[i]].storage == ECS_STORAGE_TABLE) {
+            ecs_signature_add(&query.signature, create_info->changed_components[i]);
+        }
+    }
+
     if (create_info->component_count > 0) {
         darray_u32_create(create_info->component_count, &query.components);
         darray_u32_push_range(&query.components, create_info->component_count, create_info->components);
     }
     if (create_info->without_component_count > 0) {
         darray_u32_create(create_info->without_component_count, &query.without_components);
-        darray_u32_push_range(&query.without_components, create_info->without_component_count, create_info->without_components);
+        darray_u32_push_range(&query.without_components, create_info->without_component_count, without_components);
+    }
+    if (create_info->changed_component_count > 0) {
+        darray_u32_create(create_info->changed_component_count, &query.changed_components);
+        darray_u32_push_range(&query.changed_components, create_info->changed_component_count, create_info->changed_components);
     }
 
-    // Find matching archetypes
     darray_u32_create(ECS_QUERY_INITIAL_CAPACITY, &query.archetype_indices);
-    for (u32 i = 0; i < world->archetypes.count; i++) {
-        entity_archetype_t* archetype = &world->archetypes.data[i];
-        if (ecs_query_matches_archetype(&query, archetype)) {
-            darray_u32_push(&query.archetype_indices, archetype->archetype_id);
+    darray_u32_create(ECS_QUERY_INITIAL_CAPACITY * smax(create_info->component_count + create_info->changed_component_count, 1), &query.term_columns);
+    darray_u32_create(ECS_QUERY_INITIAL_CAPACITY, &query.non_empty_matches);
+    darray_u32_create(ECS_QUERY_INITIAL_CAPACITY, &query.non_empty_slots);
+
+    // Add query to world. Archetypes keep a pointer to every query that matches them, so it is allocated before matching.
+    ecs_query_t* out_query = sallocate(sizeof(ecs_query_t), MEMORY_TAG_ECS);
+    *out_query = query;
+    darray_ecs_query_ptr_push(&world->queries, out_query);
+
+    // Any archetype the query matches has every required archetype component, so the one in the fewest archetypes gives the fewest candidates
+    ecs_component_id rarest_component = INVALID_ID;
+    for (u32 i = 0; i < create_info->component_count + create_info->changed_component_count; i++) {
+        ecs_component_id component = i < create_info->component_count ? create_info->components[i] : create_info->changed_components[i - create_info->component_count];
+        if (world->components.data[component].storage != ECS_STORAGE_TABLE) {
+            continue;
+        }
+        if (rarest_component == INVALID_ID || world->components.data[component].archetypes.count < world->components.data[rarest_component].archetypes.count) {
+            rarest_component = component;
+        }
+    }
+
+    // Index the query under the same component so new archetypes are matched against it
+    if (rarest_component == INVALID_ID) {
+        darray_ecs_query_ptr_push(&world->unindexed_queries, out_query);
+        for (u32 i = 0; i < world->archetypes.count; i++) {
+            entity_archetype_t* archetype = &world->archetypes.data[i];
+            if (ecs_query_matches_archetype(out_query, archetype)) {
+                ecs_query_add_archetype(out_query, archetype);
+            }
+        }
+    } else {
+        ecs_component_t* component = &world->components.data[rarest_component];
+        darray_ecs_query_ptr_push(&component->queries, out_query);
+        for (u32 i = 0; i < component->archetypes.count; i++) {
+            entity_archetype_t* archetype = &world->archetypes.data[component->archetypes.data[i]];
+            if (ecs_query_matches_archetype(out_query, archetype)) {
+                ecs_query_add_archetype(out_query, archetype);
+            }
         }
     }
 
-    // Add query to world
-    u32 query_index = world->queries.count;
-    darray_ecs_query_push(&world->queries, query);
-    return &world->queries.data[query_index];
+    if (!is_shared) {
+        return out_query;
+    }
+    if (first_with_hash) {
+        out_query->next_with_hash = *first_with_hash;
+        *first_with_hash = out_query;
+    } else {
+        ecs_query_map_insert(&world->query_map, query_hash, out_query);
+    }
+    return out_query;
 }
 
 void ecs_query_destroy(ecs_query_t* query) {
     darray_u32_destroy(&query->archetype_indices);
+    darray_u32_destroy(&query->term_columns);
+    darray_u32_destroy(&query->non_empty_matches);
+    darray_u32_destroy(&query->non_empty_slots);
     if (query->components.count > 0) {
         darray_u32_destroy(&query->components);
     }
     if (query->without_components.count > 0) {
         darray_u32_destroy(&query->without_components);
     }
+    if (query->changed_components.count > 0) {
+        darray_u32_destroy(&query->changed_components);
+    }
 }
 
 b8 ecs_query_matches_archetype(ecs_query_t* query, entity_archetype_t* archetype) {
@@ -81,68 +183,557 @@ b8 ecs_query_matches_archetype(ecs_query_t* query, entity_archetype_t* archetype
         SWARN("Creating query with no components to match");
         // return false;
     }
-    // Query cannot match archetype if the archetype does not have all required components
-    // This is mostly just here to avoid matching empty archetypes
-    if (archetype->component_set.count < query->components.count ) {
+    if (!ecs_signature_contains_all(&archetype->signature, &query->signature) ||
+            ecs_signature_intersects(&archetype->signature, &query->without_signature)) {
         return false;
     }
+    return true;
+}
+
+void ecs_query_add_archetype(ecs_query_t* query, entity_archetype_t* archetype) {
+    u32 match_index = query->archetype_indices.count;
+    darray_u32_push(&query->archetype_indices, archetype->archetype_id);
+    darray_u32_push(&query->non_empty_slots, INVALID_ID);
+    darray_entity_archetype_query_match_push(&archetype->query_matches, (entity_archetype_query_match_t) { .query = query, .match_index = match_index });
+    if (archetype->entities.count > 0) {
+        ecs_query_set_archetype_non_empty(query, match_index, true);
+    }
+
+    const u32 term_count = query->components.count + query->changed_components.count;
+    for (u32 i = 0; i < term_count; i++) {
+        ecs_component_id component_id = i < query->components.count ? query->components.data[i] : query->changed_components.data[i - query->components.count];
+        ecs_component_t* component = &query->world->components.data[component_id];
+
+        u32 column_index = INVALID_ID;
+        if (component->storage == ECS_STORAGE_TABLE && component->stride > 0) {
+            column_index = ecs_component_set_get_index(&archetype->component_set, component_id);
+            SASSERT(archetype->columns.data[column_index].component_stride == component->stride, "Failed to get correct component from query.");
+        }
+        darray_u32_push(&query->term_columns, column_index);
+    }
+}
 
+void ecs_query_set_archetype_non_empty(ecs_query_t* query, u32 match_index, b8 is_non_empty) {
+    u32 slot = query->non_empty_slots.data[match_index];
+    if (is_non_empty) {
+        if (slot == INVALID_ID) {
+            query->non_empty_slots.data[match_index] = query->non_empty_matches.count;
+            darray_u32_push(&query->non_empty_matches, match_index);
+        }
+        return;
+    }
+
+    if (slot == INVALID_ID) {
+        return;
+    }
+
+    // Move the last non-empty archetype into the removed slot
+    u32 last_match = query->non_empty_matches.data[query->non_empty_matches.count - 1];
+    query->non_empty_matches.data[slot] = last_match;
+    query->non_empty_slots.data[last_match] = slot;
+    query->non_empty_slots.data[match_index] = INVALID_ID;
+    query->non_empty_matches.count--;
+}
+
+// Returns the cached columns of the query's terms in its match_index'th archetype
+static const u32* ecs_query_get_term_columns(const ecs_query_t* query, u32 match_index) {
+    return query->term_columns.data + match_index * (query->components.count + query->changed_components.count);
+}
+
+/**
+ * @brief The rows of an archetype a query visits. Rows are visited in runs that are contiguous in storage and pass every filter of the query.
+ */
+typedef struct ecs_query_row_filter {
+    entity_archetype_t* archetype;
+    /**
+     * @brief The query's cached term columns for the archetype.
+     */
+    const u32* term_columns;
+    /**
+     * @brief Sparse sets an entity must or must not be in.
+     */
+    ecs_sparse_set_t* required_sets[MAX_QUERY_COMPONENT_COUNT];
+    ecs_sparse_set_t* excluded_sets[MAX_QUERY_COMPONENT_COUNT];
+    u32 required_set_count;
+    u32 excluded_set_count;
+    /**
+     * @brief For each of the query's changed components, its column in the archetype or its sparse set. At most one of the two is set, and neither for tags.
+     */
+    ecs_column_t* changed_columns[MAX_QUERY_COMPONENT_COUNT];
+    ecs_sparse_set_t* changed_sets[MAX_QUERY_COMPONENT_COUNT];
+    u32 changed_count;
+    /**
+     * @brief Rows written after this tick count as changed.
+     */
+    u32 since_tick;
+} ecs_query_row_filter_t;
+
+// A match_index of INVALID_ID creates a filter for a query without archetype terms, whose archetype is set for each entity it checks
+static void ecs_query_row_filter_create(ecs_query_t* query, u32 match_index, u32 since_tick, ecs_query_row_filter_t* out_filter) {
+    ecs_component_t* components = query->world->components.data;
+    entity_archetype_t* archetype = match_index != INVALID_ID ? &query->world->archetypes.data[query->archetype_indices.data[match_index]] : NULL;
+    out_filter->archetype = archetype;
+    out_filter->term_columns = match_index != INVALID_ID ? ecs_query_get_term_columns(query, match_index) : NULL;
+    out_filter->required_set_count = 0;
+    out_filter->excluded_set_count = 0;
+    out_filter->changed_count = query->changed_components.count;
+    out_filter->since_tick = since_tick;
+
+    for (u32 i = 0; i < query->components.count; i++) {
+        if (components[query->components.data[i]].storage == ECS_STORAGE_SPARSE) {
+            out_filter->required_sets[out_filter->required_set_count++] = &components[query->components.data[i]].sparse_set;
+        }
+    }
     for (u32 i = 0; i < query->without_components.count; i++) {
-        if (ecs_component_set_contains(&archetype->component_set, query->without_components.data[i])) {
+        if (components[query->without_components.data[i]].storage == ECS_STORAGE_SPARSE) {
+            out_filter->excluded_sets[out_filter->excluded_set_count++] = &components[query->without_components.data[i]].sparse_set;
+        }
+    }
+    for (u32 i = 0; i < query->changed_components.count; i++) {
+        ecs_component_t* component = &components[query->changed_components.data[i]];
+        if (component->storage == ECS_STORAGE_SPARSE) {
+            out_filter->changed_columns[i] = NULL;
+            out_filter->changed_sets[i] = &component->sparse_set;
+            continue;
+        }
+
+        // Tags have neither, and never count as changed
+        u32 column_index = out_filter->term_columns ? out_filter->term_columns[query->components.count + i] : INVALID_ID;
+        out_filter->changed_columns[i] = column_index != INVALID_ID ? &archetype->columns.data[column_index] : NULL;
+        out_filter->changed_sets[i] = NULL;
+    }
+}
+
+// Checks if only disabled rows need to be skipped, which can be done a word of the archetype's disabled mask at a time
+static b8 ecs_query_row_filter_is_mask_only(const ecs_query_row_filter_t* filter) {
+    return filter->required_set_count == 0 && filter->excluded_set_count == 0 && filter->changed_count == 0;
+}
+
+static b8 ecs_query_row_filter_passes(const ecs_query_row_filter_t* filter, u32 row) {
+    if (!entity_archetype_row_enabled(filter->archetype, row)) {
+        return false;
+    }
+
+    entity_t entity = filter->archetype->entities.data[row];
+    for (u32 i = 0; i < filter->required_set_count; i++) {
+        if (!ecs_sparse_set_contains(filter->required_sets[i], entity)) {
             return false;
         }
     }
+    for (u32 i = 0; i < filter->excluded_set_count; i++) {
+        if (ecs_sparse_set_contains(filter->excluded_sets[i], entity)) {
+            return false;
+        }
+    }
+
+    if (filter->changed_count == 0) {
+        return true;
+    }
+
+    for (u32 i = 0; i < filter->changed_count; i++) {
+        if (filter->changed_columns[i]) {
+            if (*ecs_component_column_get_change_tick(filter->changed_columns[i], row) > filter->since_tick) {
+                return true;
+            }
+            continue;
+        }
+
+        if (!filter->changed_sets[i]) {
+            continue;
+        }
+
+        u32 sparse_row = ecs_sparse_set_row(filter->changed_sets[i], entity);
+        if (sparse_row != INVALID_ID && *ecs_component_column_get_change_tick(&filter->changed_sets[i]->column, sparse_row) > filter->since_tick) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Checks the highest change tick of each changed term's chunk, or sparse set, holding row. If none are newer than the filter's tick, no row of the chunk can pass
+static b8 ecs_query_row_filter_chunk_changed(const ecs_query_row_filter_t* filter, u32 row) {
+    if (filter->changed_count == 0) {
+        return true;
+    }
+
+    for (u32 i = 0; i < filter->changed_count; i++) {
+        u32* max_change_tick = NULL;
+        if (filter->changed_columns[i]) {
+            max_change_tick = ecs_component_column_get_max_change_tick(filter->changed_columns[i], row);
+        } else if (filter->changed_sets[i]) {
+            max_change_tick = ecs_component_column_get_max_change_tick(&filter->changed_sets[i]->column, 0);
+        } else if (!filter->term_columns) {
+            // Not pointed at an archetype yet, so table terms can't be ruled out
+            return true;
+        }
+
+        if (max_change_tick && __atomic_load_n(max_change_tick, __ATOMIC_RELAXED) > filter->since_tick) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Finds the next run of enabled rows in [*row, end) by scanning the archetype's disabled mask. Returns the length of the run, or zero if there are none left.
+static u32 ecs_query_next_enabled_run(const entity_archetype_t* archetype, u32* row, u32 end) {
+    const darray_u64_t* mask = &archetype->disabled_mask;
+
+    // Skip disabled rows
+    while (*row < end && *row / 64 < mask->count) {
+        u64 enabled = ~mask->data[*row / 64] >> (*row % 64);
+        if (enabled != 0) {
+            *row += __builtin_ctzll(enabled);
+            break;
+        }
+        *row = (*row / 64 + 1) * 64;
+    }
+    *row = smin(*row, end);
+
+    // Rows past the end of the mask are enabled
+    u32 run_end = *row;
+    while (run_end < end) {
+        if (run_end / 64 >= mask->count) {
+            run_end = end;
+            break;
+        }
+
+        u64 disabled = mask->data[run_end / 64] >> (run_end % 64);
+        if (disabled != 0) {
+            run_end += __builtin_ctzll(disabled);
+            break;
+        }
+        run_end = (run_end / 64 + 1) * 64;
+    }
+    return smin(run_end, end) - *row;
+}
+
+// Finds the next run of rows in [*row, end) that pass the filter. Returns the length of the run, or zero if there are none left.
+static u32 ecs_query_row_filter_next_run(const ecs_query_row_filter_t* filter, u32* row, u32 end) {
+    if (ecs_query_row_filter_is_mask_only(filter)) {
+        if (filter->archetype->disabled_count == 0) {
+            return end - *row;
+        }
+        return ecs_query_next_enabled_run(filter->archetype, row, end);
+    }
+
+    while (*row < end && !ecs_query_row_filter_passes(filter, *row)) {
+        (*row)++;
+    }
+
+    u32 run_end = *row;
+    while (run_end < end && ecs_query_row_filter_passes(filter, run_end)) {
+        run_end++;
+    }
+    return run_end - *row;
+}
+
+// Points the iterator at rows [row_offset, row_offset + entity_count) of the filter's archetype
+static void ecs_query_set_iterator_range(ecs_query_t* query, const ecs_query_row_filter_t* filter, u32 row_offset, u32 entity_count, ecs_iterator_t* iterator) {
+    entity_archetype_t* archetype = filter->archetype;
+    iterator->archetype = archetype;
+    iterator->commands = ecs_world_get_command_buffer(query->world);
+    iterator->row_offset = row_offset;
+    iterator->entity_count = entity_count;
+    iterator->entities = archetype->entities.data + row_offset;
+
+    // Sparse components and tags have no column
+    for (u32 j = 0; j < query->components.count; j++) {
+        u32 column_index = filter->term_columns ? filter->term_columns[j] : INVALID_ID;
+        iterator->component_data[j] = column_index != INVALID_ID ? ecs_component_column_get(&archetype->columns.data[column_index], row_offset) : NULL;
+    }
+}
+
+// Calls the iterate function for every run of rows in [row_offset, row_offset + entity_count) that passes the filter
+static void ecs_query_iterate_rows(ecs_query_t* query, const ecs_query_row_filter_t* filter, u32 row_offset, u32 entity_count, u32 write_mask, void (iterate_function)(ecs_iterator_t* iterator), ecs_iterator_t* iterator) {
+    // A query does not see its own writes as changes the next time it runs
+    const u32 change_tick = query->changed_components.count > 0 ? query->last_change_tick : ecs_world_get_change_tick(query->world);
+    entity_archetype_t* archetype = filter->archetype;
+    const u32 end = row_offset + entity_count;
+    for (u32 row = row_offset; row < end;) {
+        // Runs never cross a chunk boundary
+        u32 span_end = row + entity_archetype_contiguous_rows(archetype, row);
+        span_end = smin(span_end, end);
+        if (!ecs_query_row_filter_chunk_changed(filter, row)) {
+            row = span_end;
+            continue;
+        }
 
+        u32 run_row = row;
+        u32 run_count;
+        while ((run_count = ecs_query_row_filter_next_run(filter, &run_row, span_end)) > 0) {
+            ecs_query_set_iterator_range(query, filter, run_row, run_count, iterator);
+            iterate_function(iterator);
+
+            for (u32 i = 0; write_mask != 0 && i < query->components.count; i++) {
+                if (((write_mask >> i) & 1) && iterator->component_data[i]) {
+                    // Runs never cross a chunk boundary, so their ticks are contiguous
+                    ecs_component_column_set_change_ticks(&archetype->columns.data[filter->term_columns[i]], run_row, run_count, change_tick);
+                }
+            }
+            run_row += run_count;
+        }
+        row = span_end;
+    }
+}
+
+// Returns the smallest sparse set a query requires if it has no archetype terms, or NULL. Such queries match every archetype, so they visit the entities of the set instead of every row of every archetype.
+static ecs_sparse_set_t* ecs_query_get_driving_set(const ecs_query_t* query) {
+    const ecs_signature_t empty_signature = { 0 };
+    if (!ecs_signature_equals(&query->signature, &empty_signature)) {
+        return NULL;
+    }
+
+    ecs_component_t* components = query->world->components.data;
+    ecs_sparse_set_t* driving_set = NULL;
     for (u32 i = 0; i < query->components.count; i++) {
-        if (!ecs_component_set_contains(&archetype->component_set, query->components.data[i])) {
-            return false;
+        ecs_component_t* component = &components[query->components.data[i]];
+        if (component->storage == ECS_STORAGE_SPARSE && (!driving_set || component->sparse_set.dense.count < driving_set->dense.count)) {
+            driving_set = &component->sparse_set;
         }
     }
+    return driving_set;
+}
 
-    if (archetype->archetype_id == 0) {
-        SERROR("How are we matching the default archetype?");
+// Points the filter at the archetype of the driving set's entity at dense_index. Returns false if the entity does not pass the query's filters.
+static b8 ecs_query_row_filter_select_entity(ecs_query_t* query, const ecs_sparse_set_t* driving_set, u32 dense_index, ecs_query_row_filter_t* filter, u32* out_row) {
+    entity_t entity = driving_set->dense.data[dense_index];
+    const entity_record_t* record = &query->world->records.data[ENTITY_INDEX(entity)];
+    entity_archetype_t* archetype = &query->world->archetypes.data[record->archetype_index];
+    if (!ecs_query_matches_archetype(query, archetype)) {
+        return false;
     }
-    return true;
+
+    filter->archetype = archetype;
+    *out_row = record->index;
+    return ecs_query_row_filter_passes(filter, record->index);
+}
+
+// Calls the iterate function for every entity in [first, first + count) of the driving set that passes the query's filters. The entities are spread over archetypes, so each is its own range.
+static void ecs_query_iterate_set_entities(ecs_query_t* query, const ecs_sparse_set_t* driving_set, u32 first, u32 count, u32 since_tick, void (iterate_function)(ecs_iterator_t* iterator), ecs_iterator_t* iterator) {
+    ecs_query_row_filter_t filter;
+    ecs_query_row_filter_create(query, INVALID_ID, since_tick, &filter);
+    if (!ecs_query_row_filter_chunk_changed(&filter, 0)) {
+        return;
+    }
+    for (u32 i = first; i < first + count; i++) {
+        u32 row;
+        if (ecs_query_row_filter_select_entity(query, driving_set, i, &filter, &row)) {
+            ecs_query_set_iterator_range(query, &filter, row, 1, iterator);
+            iterate_function(iterator);
+        }
+    }
+}
+
+// Starts an iteration of a query. Returns the tick that rows must have been written after to count as changed.
+static u32 ecs_query_begin_iteration(ecs_query_t* query) {
+    if (query->changed_components.count == 0) {
+        return 0;
+    }
+
+    // Advance the world's tick so writes made from now on are newer than this iteration
+    u32 since_tick = query->last_change_tick;
+    query->last_change_tick = atomic_fetch_add_explicit(&query->world->change_tick, 1, memory_order_relaxed);
+    return since_tick;
 }
 
 void ecs_query_create_iterator(ecs_query_t* query, ecs_iterator_t* out_iterator) {
+    *out_iterator = (ecs_iterator_t) {
+        .world = query->world,
+        .component_count = query->components.count,
+        .query = query,
+        .archetype_cursor = 0,
+        .next_row = 0,
+        .since_tick = ecs_query_begin_iteration(query),
+        .driving_set = ecs_query_get_driving_set(query),
+    };
+}
 
+b8 ecs_iterator_next(ecs_iterator_t* iterator) {
+    ecs_query_t* query = iterator->query;
+    if (iterator->driving_set) {
+        ecs_query_row_filter_t filter;
+        ecs_query_row_filter_create(query, INVALID_ID, iterator->since_tick, &filter);
+        if (!ecs_query_row_filter_chunk_changed(&filter, 0)) {
+            iterator->next_row = iterator->driving_set->dense.count;
+        }
+        while (iterator->next_row < iterator->driving_set->dense.count) {
+            u32 row;
+            if (ecs_query_row_filter_select_entity(query, iterator->driving_set, iterator->next_row++, &filter, &row)) {
+                ecs_query_set_iterator_range(query, &filter, row, 1, iterator);
+                return true;
+            }
+        }
+
+        iterator->entity_count = 0;
+        return false;
+    }
+
+    while (iterator->archetype_cursor < query->non_empty_matches.count) {
+        u32 match_index = query->non_empty_matches.data[iterator->archetype_cursor];
+        entity_archetype_t* archetype = &query->world->archetypes.data[query->archetype_indices.data[match_index]];
+        u32 row = iterator->next_row;
+        if (row >= archetype->entities.count) {
+            iterator->archetype_cursor++;
+            iterator->next_row = 0;
+            continue;
+        }
+
+        // Look for a run in the span of rows up to the next chunk boundary
+        u32 span_end = row + entity_archetype_contiguous_rows(archetype, row);
+        ecs_query_row_filter_t filter;
+        ecs_query_row_filter_create(query, match_index, iterator->since_tick, &filter);
+        if (!ecs_query_row_filter_chunk_changed(&filter, row)) {
+            iterator->next_row = span_end;
+            continue;
+        }
+        u32 run_count = ecs_query_row_filter_next_run(&filter, &row, span_end);
+        if (run_count == 0) {
+            iterator->next_row = span_end;
+            continue;
+        }
+
+        ecs_query_set_iterator_range(query, &filter, row, run_count, iterator);
+        iterator->next_row = row + run_count;
+        return true;
+    }
+
+    iterator->entity_count = 0;
+    return false;
 }
 
-void ecs_query_iterate(ecs_query_t* query, void (iterate_function)(ecs_iterator_t* iterator)) {
+void ecs_query_iterate_writes(ecs_query_t* query, void (iterate_function)(ecs_iterator_t* iterator), u32 write_mask) {
     // Create iterator
-    void* component_arrays[MAX_QUERY_COMPONENT_COUNT];
-
     ecs_iterator_t iterator = {
-        .component_data = component_arrays,
         .component_count = query->components.count,
         .world = query->world,
     };
 
-    for (u32 i = 0; i < query->archetype_indices.count; i++) {
-        entity_archetype_t* archetype = &query->world->archetypes.data[query->archetype_indices.data[i]];
-        iterator.archetype = archetype;
-        if (archetype->entities.count <= 0) {
-            continue;
-        }
+    u32 since_tick = ecs_query_begin_iteration(query);
+    // Sparse components have no column, so there are no writes to mark
+    ecs_sparse_set_t* driving_set = ecs_query_get_driving_set(query);
+    if (driving_set) {
+        ecs_query_iterate_set_entities(query, driving_set, 0, driving_set->dense.count, since_tick, iterate_function, &iterator);
+        return;
+    }
+
+    for (u32 i = 0; i < query->non_empty_matches.count; i++) {
+        u32 match_index = query->non_empty_matches.data[i];
+        entity_archetype_t* archetype = &query->world->archetypes.data[query->archetype_indices.data[match_index]];
+        ecs_query_row_filter_t filter;
+        ecs_query_row_filter_create(query, match_index, since_tick, &filter);
+        ecs_query_iterate_rows(query, &filter, 0, archetype->entities.count, write_mask, iterate_function, &iterator);
+    }
+}
 
-        // Set component arrays
-        SASSERT(query->components.count < MAX_QUERY_COMPONENT_COUNT, "QUERY HAS TOO MANY COMPONENTS");
-        for (u32 j = 0; j < query->components.count; j++) {
-            ecs_component_id component = query->components.data[j];
+void ecs_query_iterate(ecs_query_t* query, void (iterate_function)(ecs_iterator_t* iterator)) {
+    ecs_query_iterate_writes(query, iterate_function, 0);
+}
 
-            u32 component_index = ecs_component_set_get_index(&archetype->component_set, component);
-            if (component_index == INVALID_ID) {
-                SERROR("Should not get invalid ID from archetype that matches query.");
-                continue;
-            }
-            component_arrays[j] = archetype->columns.data[component_index].data;
-            SASSERT(archetype->columns.data[component_index].component_stride == query->world->components.data[component].stride, "Failed to get correct component from query.");
-        }
+typedef struct ecs_query_range_job {
+    ecs_query_t* query;
+    /**
+     * @brief The index of the range's archetype in the query's matched archetypes.
+     */
+    u32 match_index;
+    /**
+     * @brief The sparse set driving a query without archetype terms. If set, the range is of the set's entities instead of the archetype's rows.
+     */
+    const ecs_sparse_set_t* driving_set;
+    void (*iterate_function)(ecs_iterator_t* iterator);
+    u32 row_offset;
+    u32 entity_count;
+    u32 since_tick;
+} ecs_query_range_job_t;
 
-        iterator.entity_count = archetype->entities.count;
+static void ecs_query_iterate_range(void* data) {
+    ecs_query_range_job_t* job = data;
+    ecs_iterator_t iterator = {
+        .component_count = job->query->components.count,
+        .world = job->query->world,
+    };
 
-        // Call function
-        iterate_function(&iterator);
+    if (job->driving_set) {
+        ecs_query_iterate_set_entities(job->query, job->driving_set, job->row_offset, job->entity_count, job->since_tick, job->iterate_function, &iterator);
+        return;
+    }
+
+    ecs_query_row_filter_t filter;
+    ecs_query_row_filter_create(job->query, job->match_index, job->since_tick, &filter);
+    ecs_query_iterate_rows(job->query, &filter, job->row_offset, job->entity_count, 0, job->iterate_function, &iterator);
+}
+
+void ecs_query_iterate_parallel(ecs_query_t* query, void (iterate_function)(ecs_iterator_t* iterator)) {
+    ecs_world_t* world = query->world;
+
+    // Rows per range depend only on the query's components, so they are the same for every archetype
+    u32 row_stride = 0;
+    for (u32 i = 0; i < query->components.count; i++) {
+        row_stride += world->components.data[query->components.data[i]].stride;
     }
+    u32 range_rows = smax(ECS_QUERY_PARALLEL_RANGE_SIZE / smax(row_stride, 1), ECS_QUERY_PARALLEL_MIN_RANGE_ROWS);
+
+    ecs_sparse_set_t* driving_set = ecs_query_get_driving_set(query);
+    u32 range_count = 0;
+    if (driving_set) {
+        range_count = (driving_set->dense.count + range_rows - 1) / range_rows;
+    }
+    for (u32 i = 0; !driving_set && i < query->non_empty_matches.count; i++) {
+        entity_archetype_t* archetype = &world->archetypes.data[query->archetype_indices.data[query->non_empty_matches.data[i]]];
+        u32 archetype_range_rows = archetype->chunk_row_count > 0 ? archetype->chunk_row_count : range_rows;
+        range_count += (archetype->entities.count + archetype_range_rows - 1) / archetype_range_rows;
+    }
+
+    if (range_count == 0) {
+        return;
+    }
+
+    u32 since_tick = ecs_query_begin_iteration(query);
+    ecs_query_range_job_t* ranges = sallocate(sizeof(ecs_query_range_job_t) * range_count, MEMORY_TAG_JOB);
+    job_counter_t counter = { 0 };
+    u32 range_index = 0;
+    for (u32 row = 0; driving_set && row < driving_set->dense.count; row += range_rows) {
+        ecs_query_range_job_t* range = &ranges[range_index++];
+        *range = (ecs_query_range_job_t) {
+            .query = query,
+            .match_index = INVALID_ID,
+            .driving_set = driving_set,
+            .iterate_function = iterate_function,
+            .row_offset = row,
+            .entity_count = smin(range_rows, driving_set->dense.count - row),
+            .since_tick = since_tick,
+        };
+
+        job_info_t job = {
+            .function = ecs_query_iterate_range,
+            .data = range,
+            .counter = &counter,
+        };
+        job_system_submit(&world->job_system, job);
+    }
+    for (u32 i = 0; !driving_set && i < query->non_empty_matches.count; i++) {
+        u32 match_index = query->non_empty_matches.data[i];
+        entity_archetype_t* archetype = &world->archetypes.data[query->archetype_indices.data[match_index]];
+        // Chunked archetypes get one range per chunk so ranges never cross a chunk boundary
+        u32 archetype_range_rows = archetype->chunk_row_count > 0 ? archetype->chunk_row_count : range_rows;
+        for (u32 row = 0; row < archetype->entities.count; row += archetype_range_rows) {
+            ecs_query_range_job_t* range = &ranges[range_index++];
+            range->query = query;
+            range->match_index = match_index;
+            range->driving_set = NULL;
+            range->iterate_function = iterate_function;
+            range->row_offset = row;
+            range->entity_count = smin(archetype_range_rows, archetype->entities.count - row);
+            range->since_tick = since_tick;
+
+            job_info_t job = {
+                .function = ecs_query_iterate_range,
+                .data = range,
+                .counter = &counter,
+            };
+            job_system_submit(&world->job_system, job);
+        }
+    }
+
+    job_system_wait(&world->job_system, &counter);
+    sfree(ranges, sizeof(ecs_query_range_job_t) * range_count, MEMORY_TAG_JOB);
 }
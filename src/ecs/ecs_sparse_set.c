@@ -0,0 +1,57 @@
+#include "OECS/core/smemory.h"
+#include "OECS/defines.h"
+#include "OECS/ecs/ecs.h"
+#include "OECS/math.h"
+
+#define ECS_SPARSE_SET_INITIAL_CAPACITY 16
+
+void ecs_sparse_set_create(u32 stride, u32 alignment, ecs_sparse_set_t* out_set) {
+    darray_u32_create(ECS_SPARSE_SET_INITIAL_CAPACITY, &out_set->sparse);
+    darray_entity_create(ECS_SPARSE_SET_INITIAL_CAPACITY, &out_set->dense);
+    ecs_component_column_create(ECS_SPARSE_SET_INITIAL_CAPACITY, stride, alignment, 0, &out_set->column);
+}
+
+void ecs_sparse_set_destroy(ecs_sparse_set_t* set) {
+    darray_u32_destroy(&set->sparse);
+    darray_entity_destroy(&set->dense);
+    ecs_component_column_destroy(&set->column);
+}
+
+void* ecs_sparse_set_insert(ecs_sparse_set_t* set, entity_t entity, u32 change_tick) {
+    u32 entity_index = ENTITY_INDEX(entity);
+    if (entity_index >= set->sparse.count) {
+        // Grow the sparse array to cover the entity, marking every new slot as empty
+        if (entity_index >= set->sparse.capacity) {
+            darray_u32_reserve(&set->sparse, smax(set->sparse.capacity * 2, entity_index + 1));
+        }
+        sset_memory(set->sparse.data + set->sparse.count, 0xFF, sizeof(u32) * (entity_index + 1 - set->sparse.count));
+        set->sparse.count = entity_index + 1;
+    }
+
+    u32 row = set->sparse.data[entity_index];
+    if (row != INVALID_ID) {
+        return ecs_component_column_get(&set->column, row);
+    }
+
+    row = set->dense.count;
+    set->sparse.data[entity_index] = row;
+    darray_entity_push(&set->dense, entity);
+    ecs_component_column_push_zeroed(&set->column, change_tick);
+    return ecs_component_column_get(&set->column, row);
+}
+
+void ecs_sparse_set_remove(ecs_sparse_set_t* set, entity_t entity) {
+    u32 row = ecs_sparse_set_row(set, entity);
+    if (row == INVALID_ID) {
+        return;
+    }
+
+    // Move the last entity into the removed row
+    u32 last_row = set->dense.count - 1;
+    entity_t last_entity = set->dense.data[last_row];
+    set->dense.data[row] = last_entity;
+    set->sparse.data[ENTITY_INDEX(last_entity)] = row;
+    set->sparse.data[ENTITY_INDEX(entity)] = INVALID_ID;
+    set->dense.count--;
+    ecs_component_column_pop(&set->column, row);
+}
@@ -1,7 +1,10 @@
 #include "OECS/ecs/ecs.h"
 #include "OECS/ecs/ecs_world.h"
+#include "OECS/math.h"
 
 void ecs_system_create(struct ecs_world* world, ecs_phase_t phase, const ecs_query_create_info_t* create_info, void (*callback)(ecs_iterator_t*), const char* name) {
+    // write_mask holds one bit per query component
+    SASSERT(create_info->component_count <= MAX_QUERY_COMPONENT_COUNT, "Cannot create system with %d components, max is %d", create_info->component_count, MAX_QUERY_COMPONENT_COUNT);
 #if SPARK_DEBUG
     for (u32 i = 0; i < create_info->component_count; i++) {
         SASSERT(create_info->components[i] != 0, "Cannot create system, required component was not initialized (index: %d).", i);
@@ -16,13 +19,120 @@ void ecs_system_create(struct ecs_world* world, ecs_phase_t phase, const ecs_que
         .callback = callback
     };
 
+    // Split components by access so the scheduler can tell which systems may run together
+    darray_u32_create(smax(create_info->component_count, 1), &system.read_components);
+    darray_u32_create(smax(create_info->component_count, 1), &system.write_components);
+    for (u32 i = 0; i < create_info->component_count; i++) {
+        ecs_access_t access = create_info->component_access ? create_info->component_access[i] : ECS_ACCESS_READ_WRITE;
+        if (access == ECS_ACCESS_READ) {
+            darray_u32_push(&system.read_components, create_info->components[i]);
+        } else {
+            darray_u32_push(&system.write_components, create_info->components[i]);
+            system.write_mask |= 1u << i;
+        }
+    }
+    // Change ticks of changed components are read while filtering rows
+    for (u32 i = 0; i < create_info->changed_component_count; i++) {
+        darray_u32_push(&system.read_components, create_info->changed_components[i]);
+    }
+    // Resources are identified by their component, so they are scheduled like components. This only errs on the side of running systems apart.
+    for (u32 i = 0; i < create_info->resource_count; i++) {
+        ecs_access_t access = create_info->resource_access ? create_info->resource_access[i] : ECS_ACCESS_READ_WRITE;
+        darray_u32_push(access == ECS_ACCESS_READ ? &system.read_components : &system.write_components, create_info->resources[i]);
+    }
+
 #if SPARK_DEBUG
     system.name = name;
 #endif
 
     darray_ecs_system_push(&world->systems[phase], system);
+    world->schedules[phase].dirty = true;
 }
 
 void ecs_system_destroy(ecs_system_t* system) {
+    darray_u32_destroy(&system->read_components);
+    darray_u32_destroy(&system->write_components);
+}
+
+static b8 ecs_components_overlap(const darray_u32_t* a, const darray_u32_t* b) {
+    for (u32 i = 0; i < a->count; i++) {
+        for (u32 j = 0; j < b->count; j++) {
+            if (a->data[i] == b->data[j]) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+b8 ecs_system_conflicts(const ecs_system_t* a, const ecs_system_t* b) {
+    // Any number of systems can read a component at once, but a write must be exclusive
+    return ecs_components_overlap(&a->write_components, &b->write_components) ||
+        ecs_components_overlap(&a->write_components, &b->read_components) ||
+        ecs_components_overlap(&a->read_components, &b->write_components);
+}
+
+void ecs_schedule_build(darray_ecs_system_t* systems, ecs_schedule_t* schedule) {
+    const u32 system_count = systems->count;
+    darray_u32_clear(&schedule->system_indices);
+    darray_u32_clear(&schedule->batch_offsets);
+    darray_u8_clear(&schedule->conflicts);
+    schedule->dirty = false;
 
+    if (system_count == 0) {
+        darray_u32_push(&schedule->batch_offsets, 0);
+        return;
+    }
+
+    // Build the conflict graph
+    darray_u8_reserve(&schedule->conflicts, system_count * system_count);
+    schedule->conflicts.count = system_count * system_count;
+    for (u32 i = 0; i < system_count; i++) {
+        schedule->conflicts.data[i * system_count + i] = false;
+        for (u32 j = i + 1; j < system_count; j++) {
+            b8 conflicts = ecs_system_conflicts(&systems->data[i], &systems->data[j]);
+            schedule->conflicts.data[i * system_count + j] = conflicts;
+            schedule->conflicts.data[j * system_count + i] = conflicts;
+        }
+    }
+
+    // Place each system one batch after the latest conflicting system that was created before it
+    u32* batches = sallocate(sizeof(u32) * system_count, MEMORY_TAG_SYSTEM);
+    u32 batch_count = 0;
+    for (u32 i = 0; i < system_count; i++) {
+        batches[i] = 0;
+        for (u32 j = 0; j < i; j++) {
+            if (batches[j] + 1 > batches[i] && schedule->conflicts.data[i * system_count + j]) {
+                batches[i] = batches[j] + 1;
+            }
+        }
+        batch_count = smax(batch_count, batches[i] + 1);
+    }
+
+    for (u32 batch = 0; batch < batch_count; batch++) {
+        darray_u32_push(&schedule->batch_offsets, schedule->system_indices.count);
+        for (u32 i = 0; i < system_count; i++) {
+            if (batches[i] == batch) {
+                darray_u32_push(&schedule->system_indices, i);
+            }
+        }
+    }
+    darray_u32_push(&schedule->batch_offsets, schedule->system_indices.count);
+
+    sfree(batches, sizeof(u32) * system_count, MEMORY_TAG_SYSTEM);
+}
+
+void ecs_system_run(void* data) {
+    ecs_system_t* system = data;
+#ifdef SPARK_DEBUG
+    spark_clock_t clock;
+    clock_start(&clock);
+#endif
+    ecs_query_iterate_writes(system->query, system->callback, system->write_mask);
+#ifdef SPARK_DEBUG
+    clock_update(&clock);
+    system->runtime += clock.elapsed_time;
+    system->calls++;
+#endif
 }
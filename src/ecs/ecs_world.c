@@ -5,23 +5,55 @@
 
 ecs_world_t* pvt_ecs_world;
 
+// Starts the job system and creates one command buffer per job system thread
+static void ecs_world_create_workers(ecs_world_t* world, u32 worker_count) {
+    job_system_create(worker_count, &world->job_system);
+    world->command_buffers = sallocate(sizeof(ecs_command_buffer_t) * (worker_count + 1), MEMORY_TAG_ECS);
+    for (u32 i = 0; i < worker_count + 1; i++) {
+        ecs_command_buffer_create(&world->command_buffers[i]);
+    }
+}
+
+static void ecs_world_destroy_workers(ecs_world_t* world) {
+    for (u32 i = 0; i < world->job_system.thread_count + 1; i++) {
+        ecs_command_buffer_destroy(&world->command_buffers[i]);
+    }
+    sfree(world->command_buffers, sizeof(ecs_command_buffer_t) * (world->job_system.thread_count + 1), MEMORY_TAG_ECS);
+    world->command_buffers = NULL;
+    job_system_destroy(&world->job_system);
+}
+
 ecs_world_t* ecs_world_initialize() {
     pvt_ecs_world = sallocate(sizeof(ecs_world_t), MEMORY_TAG_ECS);
     pvt_ecs_world->entity_count = 0;
+    pvt_ecs_world->chunk_size = 0;
+    atomic_init(&pvt_ecs_world->change_tick, 1);
     darray_entity_record_create(100, &pvt_ecs_world->records);
+    darray_u32_create(100, &pvt_ecs_world->free_entity_indices);
     darray_ecs_component_create(100, &pvt_ecs_world->components);
+    darray_u32_create(10, &pvt_ecs_world->sparse_components);
     darray_entity_archetype_create(100, &pvt_ecs_world->archetypes);
-    darray_ecs_query_create(100, &pvt_ecs_world->queries);
+    ecs_signature_map_create(100, &pvt_ecs_world->archetype_map);
+    darray_ecs_query_ptr_create(100, &pvt_ecs_world->queries);
+    darray_ecs_query_ptr_create(10, &pvt_ecs_world->unindexed_queries);
+    ecs_query_map_create(100, &pvt_ecs_world->query_map);
     for (u32 i = 0; i < ECS_PHASE_ENUM_MAX; i++) {
         darray_ecs_system_create(20, &pvt_ecs_world->systems[i]);
+        darray_u32_create(20, &pvt_ecs_world->schedules[i].system_indices);
+        darray_u32_create(20, &pvt_ecs_world->schedules[i].batch_offsets);
+        darray_u8_create(20 * 20, &pvt_ecs_world->schedules[i].conflicts);
+        pvt_ecs_world->schedules[i].dirty = true;
     }
 
+    // The calling thread also executes jobs while waiting on a phase, so it is excluded from the worker count
+    ecs_world_create_workers(pvt_ecs_world, job_system_hardware_thread_count() - 1);
+
     // Create default (empty) archetype
     entity_archetype_create(pvt_ecs_world, 0, NULL, &pvt_ecs_world->archetypes.data[0]);
     pvt_ecs_world->archetypes.count = 1;
 
     // Create default empty component
-    ecs_world_component_define(pvt_ecs_world, "Null", 0);
+    ecs_world_component_define(pvt_ecs_world, "Null", 0, 1, ECS_STORAGE_TABLE);
 
     return pvt_ecs_world;
 }
@@ -31,14 +63,23 @@ ecs_world_t* ecs_world_get() {
 }
 
 void ecs_world_shutdown(ecs_world_t* world) {
+    ecs_world_destroy_workers(world);
+
     for (u32 i = 0; i < world->archetypes.count; i++) {
         entity_archetype_destroy(&pvt_ecs_world->archetypes.data[i]);
     }
     for (u32 i = 0; i < world->components.count; i++) {
-        darray_entity_archetype_ptr_destroy(&pvt_ecs_world->components.data[i].archetypes);
+        darray_u32_destroy(&pvt_ecs_world->components.data[i].archetypes);
+        darray_ecs_query_ptr_destroy(&pvt_ecs_world->components.data[i].queries);
+        ecs_world_remove_resource(world, i);
+    }
+    for (u32 i = 0; i < world->sparse_components.count; i++) {
+        ecs_sparse_set_destroy(&pvt_ecs_world->components.data[world->sparse_components.data[i]].sparse_set);
     }
+    darray_u32_destroy(&pvt_ecs_world->sparse_components);
     for (u32 i = 0; i < world->queries.count; i++) {
-        ecs_query_destroy(&pvt_ecs_world->queries.data[i]);
+        ecs_query_destroy(pvt_ecs_world->queries.data[i]);
+        sfree(pvt_ecs_world->queries.data[i], sizeof(ecs_query_t), MEMORY_TAG_ECS);
     }
 
     for (u32 i = 0; i < ECS_PHASE_ENUM_MAX; i++) {
@@ -48,40 +89,146 @@ void ecs_world_shutdown(ecs_world_t* world) {
             SDEBUG("ECS System '%s' took average of %.03fms", system->name, system->runtime / system->calls * 1000.0f);
         }
 #endif
+        for (u32 s = 0; s < pvt_ecs_world->systems[i].count; s++) {
+            ecs_system_destroy(&pvt_ecs_world->systems[i].data[s]);
+        }
         darray_ecs_system_destroy(&pvt_ecs_world->systems[i]);
+        darray_u32_destroy(&pvt_ecs_world->schedules[i].system_indices);
+        darray_u32_destroy(&pvt_ecs_world->schedules[i].batch_offsets);
+        darray_u8_destroy(&pvt_ecs_world->schedules[i].conflicts);
     }
-    darray_ecs_query_destroy(&pvt_ecs_world->queries);
+    darray_ecs_query_ptr_destroy(&pvt_ecs_world->queries);
+    darray_ecs_query_ptr_destroy(&pvt_ecs_world->unindexed_queries);
+    ecs_query_map_destroy(&pvt_ecs_world->query_map);
     darray_entity_record_destroy(&pvt_ecs_world->records);
+    darray_u32_destroy(&pvt_ecs_world->free_entity_indices);
     darray_ecs_component_destroy(&pvt_ecs_world->components);
     darray_entity_archetype_destroy(&pvt_ecs_world->archetypes);
+    ecs_signature_map_destroy(&pvt_ecs_world->archetype_map);
+
+    if (pvt_ecs_world == world) {
+        pvt_ecs_world = NULL;
+    }
+    sfree(world, sizeof(ecs_world_t), MEMORY_TAG_ECS);
+}
+
+u32 ecs_world_get_change_tick(ecs_world_t* world) {
+    return atomic_load_explicit(&world->change_tick, memory_order_relaxed);
+}
+
+void ecs_world_set_worker_count(ecs_world_t* world, u32 worker_count) {
+    SASSERT(job_system_thread_index(&world->job_system) == 0, "The worker count can only be changed from the thread that owns the world.");
+    if (worker_count == world->job_system.thread_count) {
+        return;
+    }
+
+    // Commands recorded so far would be lost with their buffers
+    ecs_world_flush_commands(world);
+    ecs_world_destroy_workers(world);
+    ecs_world_create_workers(world, worker_count);
+}
+
+void ecs_world_set_chunk_size(ecs_world_t* world, u32 chunk_size) {
+    if (world->archetypes.count > 1) {
+        SWARN("Setting chunk size after archetypes have been created. Existing archetypes keep their current storage.");
+    }
+    world->chunk_size = chunk_size;
 }
 
-ecs_component_id ecs_world_component_define(ecs_world_t* world, const char* name, u32 stride) {
+ecs_component_id ecs_world_component_define(ecs_world_t* world, const char* name, u32 stride, u32 alignment, ecs_storage_kind_t storage) {
+    SASSERT(world->components.count < ECS_MAX_COMPONENT_COUNT, "Cannot define component '%s', a world can have at most %d components.", name, ECS_MAX_COMPONENT_COUNT);
     ecs_component_t component = {
         .stride = stride,
+        .alignment = alignment,
+        .storage = storage,
         .name = name,
     };
-    darray_entity_archetype_ptr_create(5, &component.archetypes);
+    darray_u32_create(5, &component.archetypes);
+    darray_ecs_query_ptr_create(5, &component.queries);
 
     ecs_component_id component_id = world->components.count;
+    if (storage == ECS_STORAGE_SPARSE) {
+        ecs_sparse_set_create(stride, alignment, &component.sparse_set);
+        darray_u32_push(&world->sparse_components, component_id);
+    }
     darray_ecs_component_push(&world->components, component);
     return component_id;
 }
 
 void ecs_world_progress(ecs_world_t* world) {
     for (u32 phase = 0; phase < ECS_PHASE_ENUM_MAX; phase++) {
-        for (u32 i = 0; i < world->systems[phase].count; i++) {
-            ecs_system_t* system = &world->systems[phase].data[i];
-#ifdef SPARK_DEBUG
-            spark_clock_t clock;
-            clock_start(&clock);
-#endif
-            ecs_query_iterate(system->query, system->callback);
-#ifdef SPARK_DEBUG
-            clock_update(&clock);
-            system->runtime += clock.elapsed_time;
-            system->calls++;
-#endif
+        darray_ecs_system_t* systems = &world->systems[phase];
+        ecs_schedule_t* schedule = &world->schedules[phase];
+        if (schedule->dirty) {
+            ecs_schedule_build(systems, schedule);
+        }
+
+        for (u32 batch = 0; batch + 1 < schedule->batch_offsets.count; batch++) {
+            u32 start = schedule->batch_offsets.data[batch];
+            u32 end = schedule->batch_offsets.data[batch + 1];
+
+            // No point paying for a job when nothing can run alongside it
+            if (end - start == 1) {
+                ecs_system_run(&systems->data[schedule->system_indices.data[start]]);
+                continue;
+            }
+
+            job_counter_t counter = { 0 };
+            for (u32 i = start; i < end; i++) {
+                ecs_system_t* system = &systems->data[schedule->system_indices.data[i]];
+                // Systems without any entities to visit are not worth a job
+                if (system->query->non_empty_matches.count == 0) {
+                    continue;
+                }
+
+                job_info_t job = {
+                    .function = ecs_system_run,
+                    .data = system,
+                    .counter = &counter,
+                };
+                job_system_submit(&world->job_system, job);
+            }
+            job_system_wait(&world->job_system, &counter);
         }
+
+        ecs_world_flush_commands(world);
     }
 }
+
+ecs_command_buffer_t* ecs_world_get_command_buffer(ecs_world_t* world) {
+    u32 thread_index = job_system_thread_index(&world->job_system);
+    SASSERT(thread_index <= world->job_system.thread_count, "Thread %d does not belong to the world's job system.", thread_index);
+    return &world->command_buffers[thread_index];
+}
+
+void ecs_world_flush_commands(ecs_world_t* world) {
+    for (u32 i = 0; i < world->job_system.thread_count + 1; i++) {
+        ecs_command_buffer_flush(&world->command_buffers[i], world);
+    }
+}
+
+void* ecs_world_set_resource(ecs_world_t* world, ecs_component_id component, const void* data, u32 stride) {
+    ecs_component_t* component_data = &world->components.data[component];
+    SASSERT(component_data->stride == stride, "Cannot set resource '%s' with stride %d, expected stride %d.", component_data->name, stride, component_data->stride);
+    SASSERT(stride > 0, "Cannot set resource '%s', tags have no data.", component_data->name);
+
+    if (!component_data->resource) {
+        component_data->resource = sallocate_aligned(stride, component_data->alignment, MEMORY_TAG_ECS);
+    }
+    if (data) {
+        scopy_memory(component_data->resource, data, stride);
+    } else {
+        szero_memory(component_data->resource, stride);
+    }
+    return component_data->resource;
+}
+
+void ecs_world_remove_resource(ecs_world_t* world, ecs_component_id component) {
+    ecs_component_t* component_data = &world->components.data[component];
+    if (!component_data->resource) {
+        return;
+    }
+
+    sfree(component_data->resource, component_data->stride, MEMORY_TAG_ECS);
+    component_data->resource = NULL;
+}
@@ -2,60 +2,195 @@
 #include "OECS/defines.h"
 #include "OECS/ecs/ecs.h"
 #include "OECS/ecs/ecs_world.h"
+#include "OECS/math.h"
 
-// =========================
-// Private functions
-// =========================
-void entity_transition_archetype(struct ecs_world* world, 
-        entity_t entity, 
-        entity_archetype_t* dest_archetype);
-
-entity_t entity_create(struct ecs_world* world) {
-    entity_t entity = world->entity_count++;
+// Assigns an entity handle to a row of an archetype, reusing the index of a destroyed entity if there is one
+static entity_t entity_allocate(struct ecs_world* world, u32 archetype_index, ecs_index row) {
     entity_record_t record = {
-        .archetype_index = 0,
-        .index = world->archetypes.data[0].columns.count,
+        .archetype_index = archetype_index,
+        .index = row,
+        .generation = 0,
     };
-    darray_entity_push(&world->archetypes.data[0].entities, entity);
-    darray_entity_record_push(&world->records, record);
+
+    u32 entity_index;
+    if (world->free_entity_indices.count > 0) {
+        entity_index = world->free_entity_indices.data[--world->free_entity_indices.count];
+        record.generation = world->records.data[entity_index].generation;
+        world->records.data[entity_index] = record;
+    } else {
+        entity_index = world->records.count;
+        darray_entity_record_push(&world->records, record);
+    }
+
+    return ENTITY_MAKE(entity_index, record.generation);
+}
+
+// Returns the sparse set of a component, or NULL if the component is stored in archetypes
+static ecs_sparse_set_t* entity_component_sparse_set(struct ecs_world* world, ecs_index component) {
+    ecs_component_t* component_data = &world->components.data[component];
+    return component_data->storage == ECS_STORAGE_SPARSE ? &component_data->sparse_set : NULL;
+}
+
+entity_t entity_create(struct ecs_world* world) {
+    entity_archetype_t* empty_archetype = &world->archetypes.data[0];
+    entity_t entity = entity_allocate(world, 0, empty_archetype->entities.count);
+    darray_entity_push(&empty_archetype->entities, entity);
+    if (empty_archetype->entities.count == 1) {
+        entity_archetype_update_queries(empty_archetype);
+    }
+    world->entity_count++;
 
     return entity;
 }
 
+const entity_t* entity_create_bulk(struct ecs_world* world, u32 count, const ecs_component_id* components, u32 component_count, const void* const* initial_data) {
+    // Sparse components are not part of the archetype and are added once the entities exist
+    ecs_component_id table_components[smax(component_count, 1)];
+    u32 table_component_count = 0;
+    for (u32 i = 0; i < component_count; i++) {
+        if (!entity_component_sparse_set(world, components[i])) {
+            table_components[table_component_count++] = components[i];
+        }
+    }
+
+    entity_archetype_t* archetype = entity_archetype_get_or_create(world, table_component_count, table_components);
+    if (count == 0) {
+        return archetype->entities.data + archetype->entities.count;
+    }
+
+    entity_archetype_reserve(archetype, count);
+    u32 new_record_count = count > world->free_entity_indices.count ? count - world->free_entity_indices.count : 0;
+    darray_entity_record_reserve(&world->records, world->records.count + new_record_count);
+
+    const ecs_index first_row = archetype->entities.count;
+    const u32 change_tick = ecs_world_get_change_tick(world);
+    for (u32 i = 0; i < count; i++) {
+        archetype->entities.data[first_row + i] = entity_allocate(world, archetype->archetype_id, first_row + i);
+    }
+    archetype->entities.count += count;
+    if (first_row == 0) {
+        entity_archetype_update_queries(archetype);
+    }
+
+    for (u32 i = 0; i < component_count; i++) {
+        ecs_sparse_set_t* sparse_set = entity_component_sparse_set(world, components[i]);
+        if (sparse_set) {
+            for (u32 row = 0; row < count; row++) {
+                void* dest = ecs_sparse_set_insert(sparse_set, archetype->entities.data[first_row + row], change_tick);
+                if (initial_data && initial_data[i] && sparse_set->column.component_stride > 0) {
+                    scopy_memory(dest, (const u8*)initial_data[i] + row * sparse_set->column.component_stride, sparse_set->column.component_stride);
+                }
+            }
+            continue;
+        }
+
+        ecs_column_t* column = entity_archetype_get_column(archetype, components[i]);
+        if (!column) {
+            continue;
+        }
+
+        for (ecs_index row = first_row; row < archetype->entities.count;) {
+            u32 row_count = entity_archetype_contiguous_rows(archetype, row);
+            void* dest = ecs_component_column_get(column, row);
+            if (initial_data && initial_data[i]) {
+                scopy_memory(dest, (const u8*)initial_data[i] + (row - first_row) * column->component_stride, row_count * column->component_stride);
+            } else {
+                szero_memory(dest, row_count * column->component_stride);
+            }
+            ecs_component_column_set_change_ticks(column, row, row_count, change_tick);
+            row += row_count;
+        }
+        column->count += count;
+    }
+
+    world->entity_count += count;
+    return archetype->entities.data + first_row;
+}
+
+void entity_destroy(struct ecs_world* world, entity_t entity) {
+    if (!entity_is_alive(world, entity)) {
+        SWARN("Cannot destroy entity 0x%lx, it is not alive.", entity);
+        return;
+    }
+
+    for (u32 i = 0; i < world->sparse_components.count; i++) {
+        ecs_sparse_set_remove(&world->components.data[world->sparse_components.data[i]].sparse_set, entity);
+    }
+
+    entity_record_t* record = &world->records.data[ENTITY_INDEX(entity)];
+    entity_archetype_remove_row(world, &world->archetypes.data[record->archetype_index], record->index);
+
+    record->archetype_index = INVALID_ID;
+    record->index = INVALID_ID_U64;
+    record->generation++;
+    if (record->generation >= ENTITY_PENDING_GENERATION) {
+        record->generation = 0;
+    }
+    darray_u32_push(&world->free_entity_indices, ENTITY_INDEX(entity));
+    world->entity_count--;
+}
+
+b8 entity_is_alive(struct ecs_world* world, entity_t entity) {
+    u32 entity_index = ENTITY_INDEX(entity);
+    return entity_index < world->records.count && 
+        world->records.data[entity_index].generation == ENTITY_GENERATION(entity) &&
+        world->records.data[entity_index].archetype_index != INVALID_ID;
+}
+
 b8 entity_has_component(struct ecs_world* world, entity_t entity, ecs_index component) {
-    entity_record_t record = world->records.data[entity];
+    SASSERT(entity_is_alive(world, entity), "Entity 0x%lx is not alive.", entity);
+    ecs_sparse_set_t* sparse_set = entity_component_sparse_set(world, component);
+    if (sparse_set) {
+        return ecs_sparse_set_contains(sparse_set, entity);
+    }
+
+    entity_record_t record = world->records.data[ENTITY_INDEX(entity)];
     entity_archetype_t* archetype = &world->archetypes.data[record.archetype_index];
 
     return ecs_component_set_contains(&archetype->component_set, component);
 }
 
 void* entity_get_component(struct ecs_world* world, entity_t entity, ecs_index component) {
-    entity_record_t record = world->records.data[entity];
+    SASSERT(entity_is_alive(world, entity), "Entity 0x%lx is not alive.", entity);
+    entity_record_t record = world->records.data[ENTITY_INDEX(entity)];
     entity_archetype_t* archetype = &world->archetypes.data[record.archetype_index];
 
+    ecs_sparse_set_t* sparse_set = entity_component_sparse_set(world, component);
+    if (sparse_set) {
+        if (!ecs_sparse_set_contains(sparse_set, entity)) {
+            SERROR("Failed to get component '%s' from entity 0x%x.", world->components.data[component].name, entity);
+            return NULL;
+        }
+        return ecs_sparse_set_get(sparse_set, entity);
+    }
+
     if (!ecs_component_set_contains(&archetype->component_set, component)) {
         SERROR("Failed to get component '%s' from entity 0x%x.", world->components.data[component].name, entity);
         return NULL;
     }
 
-    u32 component_column_index = ecs_component_set_get_index(&archetype->component_set, component);
-    ecs_column_t column = archetype->columns.data[component_column_index];
-
-    return column.data + record.index * column.component_stride; 
+    // Tags have no data
+    ecs_column_t* column = entity_archetype_get_column(archetype, component);
+    return column ? ecs_component_column_get(column, record.index) : NULL;
 }
 
 b8 entity_try_get_component(struct ecs_world* world, entity_t entity, ecs_index component, void** out_data) {
-    entity_record_t record = world->records.data[entity];
+    SASSERT(entity_is_alive(world, entity), "Entity 0x%lx is not alive.", entity);
+    entity_record_t record = world->records.data[ENTITY_INDEX(entity)];
     entity_archetype_t* archetype = &world->archetypes.data[record.archetype_index];
 
+    ecs_sparse_set_t* sparse_set = entity_component_sparse_set(world, component);
+    if (sparse_set) {
+        *out_data = ecs_sparse_set_get(sparse_set, entity);
+        return ecs_sparse_set_contains(sparse_set, entity);
+    }
+
     if (!ecs_component_set_contains(&archetype->component_set, component)) {
         return false;
     }
 
-    u32 component_column_index = ecs_component_set_get_index(&archetype->component_set, component);
-    ecs_column_t column = archetype->columns.data[component_column_index];
-
-    *out_data = column.data + record.index * column.component_stride;
+    ecs_column_t* column = entity_archetype_get_column(archetype, component);
+    *out_data = column ? ecs_component_column_get(column, record.index) : NULL;
     return true;
 }
 
@@ -64,130 +199,186 @@ void entity_add_component(struct ecs_world* world, entity_t entity, ecs_componen
         return;
     }
 
-    entity_record_t record = world->records.data[entity];
-    entity_archetype_t* current_archetype = &world->archetypes.data[record.archetype_index];
-
-    entity_archetype_t* new_archetype = NULL;
-    if (entity_archetype_ptr_map_try_get(&current_archetype->edges.add_edges, component_id, &new_archetype)) {
-        // New archetype should be acquired, just need to transition between them
-        entity_transition_archetype(world, entity, new_archetype);
-
-        // Reserve space for the new component
-        u32 column_index = ecs_component_set_get_index(&new_archetype->component_set, component_id);
-        ecs_column_t* column = &new_archetype->columns.data[column_index];
-        if (column->count >= column->capacity - 1) {
-            ecs_component_column_resize(column, column->capacity * ECS_COLUMN_RESIZE_FACTOR);
-        }
-        column->count++;
-
+    // Sparse components never move the entity
+    ecs_sparse_set_t* sparse_set = entity_component_sparse_set(world, component_id);
+    if (sparse_set) {
+        ecs_sparse_set_insert(sparse_set, entity, ecs_world_get_change_tick(world));
         return;
     }
 
-    // Check if the new archetype exists
-    u32 target_component_count = current_archetype->component_set.count + 1;
-    ecs_component_t component = world->components.data[component_id];
-
-    for (u32 i = 0; i < component.archetypes.count; i++) {
-        entity_archetype_t* archetype = component.archetypes.data[i];
-
-        // Size check
-        if (archetype->component_set.count != target_component_count || 
-                !ecs_component_set_contains(&archetype->component_set, component_id)) {
-            continue;
-        }
-
-        // Check if the source archetype is null, if so, just set the archetype
-        if (current_archetype->archetype_id == 0) {
-            new_archetype = archetype;
-            break;
-        }
-
-        // Type check
-        b8 is_existing_archetype = true;
-        for (u32 j = 0; j < current_archetype->component_set.capacity; j++) {
-            ecs_component_id component = current_archetype->component_set.data[j].value;
-            if (component == INVALID_ID) {
-                continue;
-            }
-            if (!ecs_component_set_contains(&archetype->component_set, component)) {
-                is_existing_archetype = false;
-                break;
+    SASSERT(entity_is_alive(world, entity), "Entity 0x%lx is not alive.", entity);
+    entity_record_t record = world->records.data[ENTITY_INDEX(entity)];
+    entity_archetype_edge_map_t* add_edges = &world->archetypes.data[record.archetype_index].edges.add_edges;
+
+    entity_archetype_edge_target_t edge;
+    if (!entity_archetype_edge_map_try_get(add_edges, component_id, &edge)) {
+        // Find or create the new archetype and remember the path to it
+        entity_archetype_t* current_archetype = &world->archetypes.data[record.archetype_index];
+        ecs_component_id components[current_archetype->component_set.count + 1];
+        u32 component_count = 0;
+        for (u32 i = 0; i < current_archetype->component_set.capacity; i++) {
+            if (current_archetype->component_set.data[i].value != INVALID_ID) {
+                components[component_count++] = current_archetype->component_set.data[i].value;
             }
         }
+        components[component_count++] = component_id;
 
-        if (!is_existing_archetype) {
-            continue;
-        }
-
-        new_archetype = archetype;
-        break;
+        u32 new_archetype_id = entity_archetype_get_or_create(world, component_count, components)->archetype_id;
+        entity_archetype_connect(world, record.archetype_index, new_archetype_id, component_id);
+        entity_archetype_edge_map_try_get(&world->archetypes.data[record.archetype_index].edges.add_edges, component_id, &edge);
     }
 
-    if (!new_archetype) {
-        // Failed to find new archetype, need to create it
-        new_archetype = entity_archetype_create_from_base(world, &world->archetypes.data[record.archetype_index], 1, &component_id);
-        entity_archetype_match_queryies(new_archetype, world);
+    entity_transition_archetype_mapped(world, entity, &world->archetypes.data[edge.archetype_id], edge.column_map);
+}
+
+void entity_remove_component(struct ecs_world* world, entity_t entity, ecs_component_id component_id) {
+    if (!entity_has_component(world, entity, component_id)) {
+        return;
     }
 
-    // Add edges
-    entity_archetype_ptr_map_insert(&world->archetypes.data[record.archetype_index].edges.add_edges, component_id, new_archetype);
-    entity_archetype_ptr_map_insert(&new_archetype->edges.remove_edges, component_id, current_archetype);
+    ecs_sparse_set_t* sparse_set = entity_component_sparse_set(world, component_id);
+    if (sparse_set) {
+        ecs_sparse_set_remove(sparse_set, entity);
+        return;
+    }
 
-    // New archetype should be acquired, just need to transition between them
-    entity_transition_archetype(world, entity, new_archetype);
+    entity_record_t record = world->records.data[ENTITY_INDEX(entity)];
+    entity_archetype_edge_map_t* remove_edges = &world->archetypes.data[record.archetype_index].edges.remove_edges;
+
+    entity_archetype_edge_target_t edge;
+    if (!entity_archetype_edge_map_try_get(remove_edges, component_id, &edge)) {
+        // Find or create the smaller archetype and remember the path to it
+        entity_archetype_t* current_archetype = &world->archetypes.data[record.archetype_index];
+        ecs_component_id components[current_archetype->component_set.count];
+        u32 component_count = 0;
+        for (u32 i = 0; i < current_archetype->component_set.capacity; i++) {
+            ecs_component_id component = current_archetype->component_set.data[i].value;
+            if (component != INVALID_ID && component != component_id) {
+                components[component_count++] = component;
+            }
+        }
 
-    // Add new component to new archetype column
-    u32 new_column_index = ecs_component_set_get_index(&new_archetype->component_set, component_id);
-    SASSERT(new_column_index != INVALID_ID, "Failed to get component id of new archetype set.");
-    ecs_column_t* column = &new_archetype->columns.data[new_column_index];
-    if (column->count >= column->capacity - 1) {
-        ecs_component_column_resize(column, column->capacity * ECS_COLUMN_RESIZE_FACTOR);
+        u32 new_archetype_id = entity_archetype_get_or_create(world, component_count, components)->archetype_id;
+        entity_archetype_connect(world, new_archetype_id, record.archetype_index, component_id);
+        entity_archetype_edge_map_try_get(&world->archetypes.data[record.archetype_index].edges.remove_edges, component_id, &edge);
     }
 
-    column->count++;
+    entity_transition_archetype_mapped(world, entity, &world->archetypes.data[edge.archetype_id], edge.column_map);
 }
 
 void entity_transition_archetype(struct ecs_world* world, 
         entity_t entity, 
         entity_archetype_t* dest_archetype) {
-    entity_record_t* record = &world->records.data[entity];
+    entity_archetype_t* source_archetype = &world->archetypes.data[world->records.data[ENTITY_INDEX(entity)].archetype_index];
+
+    u32 column_map[smax(dest_archetype->columns.count, 1)];
+    entity_archetype_build_column_map(source_archetype, dest_archetype, column_map);
+    entity_transition_archetype_mapped(world, entity, dest_archetype, column_map);
+}
+
+void entity_transition_archetype_mapped(struct ecs_world* world, entity_t entity, entity_archetype_t* dest_archetype, const u32* column_map) {
+    entity_record_t* record = &world->records.data[ENTITY_INDEX(entity)];
     entity_archetype_t* source_archetype = &world->archetypes.data[record->archetype_index];
     ecs_index entity_row = record->index;
 
     // Move entity from one archetype to the next
-    darray_entity_pop(&source_archetype->entities, entity_row);
     ecs_index future_index = dest_archetype->entities.count;
     darray_entity_push(&dest_archetype->entities, entity);
+    if (future_index == 0) {
+        entity_archetype_update_queries(dest_archetype);
+    }
 
-    // Append each component from source to dest
-    for (u32 i = 0; i < source_archetype->component_set.capacity; i++) {
-        ecs_component_id component = source_archetype->component_set.data[i].value;
-        if (component == INVALID_ID) {
+    for (u32 i = 0; i < dest_archetype->columns.count; i++) {
+        ecs_column_t* dest_column = &dest_archetype->columns.data[i];
+        if (column_map[i] == INVALID_ID) {
+            ecs_component_column_push_zeroed(dest_column, ecs_world_get_change_tick(world));
             continue;
         }
-        u32 source_column_index = ecs_component_set_get_index(&source_archetype->component_set, component);
-        u32 dest_column_index = ecs_component_set_get_index(&dest_archetype->component_set, component);
 
-        ecs_column_t* source_column = &source_archetype->columns.data[source_column_index];
-        void* source_data = source_column->data + entity_row * source_column->component_stride;
-        ecs_component_column_push(&dest_archetype->columns.data[dest_column_index], source_data);
+        ecs_column_t* source_column = &source_archetype->columns.data[column_map[i]];
+        ecs_component_column_push(dest_column, ecs_component_column_get(source_column, entity_row), *ecs_component_column_get_change_tick(source_column, entity_row));
+    }
 
-        // Remove data from source archetype
-        ecs_component_column_pop(&source_archetype->columns.data[source_column_index], entity_row);
+    // Disabled entities stay disabled
+    if (!entity_archetype_row_enabled(source_archetype, entity_row)) {
+        entity_archetype_set_row_enabled(dest_archetype, future_index, false);
     }
 
+    // Remove data from source archetype
+    entity_archetype_remove_row(world, source_archetype, entity_row);
+
     // Update the record
     record->index = future_index;
     record->archetype_index = dest_archetype->archetype_id;
 }
 
 void entity_set_component(struct ecs_world* world, entity_t entity, ecs_component_id component, void* data, u32 stride) {
+    ecs_sparse_set_t* sparse_set = entity_component_sparse_set(world, component);
+    if (sparse_set) {
+        SASSERT(entity_is_alive(world, entity), "Entity 0x%lx is not alive.", entity);
+        void* dest = ecs_sparse_set_insert(sparse_set, entity, ecs_world_get_change_tick(world));
+        if (stride > 0) {
+            scopy_memory(dest, data, stride);
+        }
+        ecs_component_column_set_change_ticks(&sparse_set->column, ecs_sparse_set_row(sparse_set, entity), 1, ecs_world_get_change_tick(world));
+        return;
+    }
+
     if (!entity_has_component(world, entity, component)) {
         entity_add_component(world, entity, component);
     }
 
-    entity_record_t record = world->records.data[entity];
-    u32 column_index = ecs_component_set_get_index(&world->archetypes.data[record.archetype_index].component_set, component);
-    SASSERT(column_index != INVALID_ID, "Cannot set component %s to entity %d when entity does not have component.", world->components.data[component].name, entity);
-    scopy_memory(world->archetypes.data[record.archetype_index].columns.data[column_index].data + record.index * stride, data, stride);
+    SASSERT(entity_is_alive(world, entity), "Entity 0x%lx is not alive.", entity);
+    entity_record_t record = world->records.data[ENTITY_INDEX(entity)];
+    ecs_column_t* column = entity_archetype_get_column(&world->archetypes.data[record.archetype_index], component);
+    if (!column) {
+        // Tags have no value to set
+        return;
+    }
+    scopy_memory(ecs_component_column_get(column, record.index), data, stride);
+    ecs_component_column_set_change_ticks(column, record.index, 1, ecs_world_get_change_tick(world));
+}
+
+void entity_mark_changed(struct ecs_world* world, entity_t entity, ecs_component_id component) {
+    SASSERT(entity_is_alive(world, entity), "Entity 0x%lx is not alive.", entity);
+    ecs_sparse_set_t* sparse_set = entity_component_sparse_set(world, component);
+    if (sparse_set) {
+        u32 row = ecs_sparse_set_row(sparse_set, entity);
+        if (row == INVALID_ID) {
+            SERROR("Cannot mark component '%s' of entity 0x%lx as changed, the entity does not have it.", world->components.data[component].name, entity);
+            return;
+        }
+        ecs_component_column_set_change_ticks(&sparse_set->column, row, 1, ecs_world_get_change_tick(world));
+        return;
+    }
+
+    entity_record_t record = world->records.data[ENTITY_INDEX(entity)];
+    entity_archetype_t* archetype = &world->archetypes.data[record.archetype_index];
+    if (!ecs_component_set_contains(&archetype->component_set, component)) {
+        SERROR("Cannot mark component '%s' of entity 0x%lx as changed, the entity does not have it.", world->components.data[component].name, entity);
+        return;
+    }
+
+    ecs_column_t* column = entity_archetype_get_column(archetype, component);
+    if (column) {
+        ecs_component_column_set_change_ticks(column, record.index, 1, ecs_world_get_change_tick(world));
+    }
+}
+
+void entity_enable(struct ecs_world* world, entity_t entity) {
+    SASSERT(entity_is_alive(world, entity), "Entity 0x%lx is not alive.", entity);
+    entity_record_t record = world->records.data[ENTITY_INDEX(entity)];
+    entity_archetype_set_row_enabled(&world->archetypes.data[record.archetype_index], record.index, true);
+}
+
+void entity_disable(struct ecs_world* world, entity_t entity) {
+    SASSERT(entity_is_alive(world, entity), "Entity 0x%lx is not alive.", entity);
+    entity_record_t record = world->records.data[ENTITY_INDEX(entity)];
+    entity_archetype_set_row_enabled(&world->archetypes.data[record.archetype_index], record.index, false);
+}
+
+b8 entity_is_enabled(struct ecs_world* world, entity_t entity) {
+    SASSERT(entity_is_alive(world, entity), "Entity 0x%lx is not alive.", entity);
+    entity_record_t record = world->records.data[ENTITY_INDEX(entity)];
+    return entity_archetype_row_enabled(&world->archetypes.data[record.archetype_index], record.index);
 }
@@ -8,68 +8,136 @@
 
 #define EDGE_MAP_DEFAULT_CAPACITY 30
 
+// Adds an archetype to the world's signature map
+static void entity_archetype_register_signature(struct ecs_world* world, entity_archetype_t* archetype) {
+    u64 hash = ecs_signature_hash(&archetype->signature);
+    u32* first_with_hash = ecs_signature_map_get(&world->archetype_map, hash);
+    if (first_with_hash) {
+        archetype->next_with_hash = *first_with_hash;
+        *first_with_hash = archetype->archetype_id;
+        return;
+    }
+
+    archetype->next_with_hash = INVALID_ID;
+    ecs_signature_map_insert(&world->archetype_map, hash, archetype->archetype_id);
+}
+
+// Fits as many rows as possible into a chunk of the world's chunk size
+static u32 entity_archetype_chunk_row_count(struct ecs_world* world, entity_archetype_t* archetype) {
+    if (world->chunk_size == 0) {
+        return 0;
+    }
+
+    u32 row_size = 0;
+    for (u32 i = 0; i < archetype->component_set.capacity; i++) {
+        ecs_component_id component = archetype->component_set.data[i].value;
+        if (component != INVALID_ID) {
+            row_size += world->components.data[component].stride;
+        }
+    }
+    return smax(world->chunk_size / smax(row_size, 1), 1);
+}
+
 void entity_archetype_create(struct ecs_world* world, u32 component_count, ecs_component_id* components, entity_archetype_t* out_archetype) {
     out_archetype->archetype_id = world->archetypes.count;
 
     darray_entity_create(32, &out_archetype->entities);
+    darray_u64_create(1, &out_archetype->disabled_mask);
+    darray_entity_archetype_query_match_create(4, &out_archetype->query_matches);
     if (component_count > 0) {
         darray_ecs_column_create(component_count, &out_archetype->columns);
     }
     ecs_component_set_create(smax(component_count, 1), &out_archetype->component_set);
 
-    entity_archetype_ptr_map_create(EDGE_MAP_DEFAULT_CAPACITY , &out_archetype->edges.add_edges);
-    entity_archetype_ptr_map_create(EDGE_MAP_DEFAULT_CAPACITY, &out_archetype->edges.remove_edges);
+    entity_archetype_edge_map_create(EDGE_MAP_DEFAULT_CAPACITY , &out_archetype->edges.add_edges);
+    entity_archetype_edge_map_create(EDGE_MAP_DEFAULT_CAPACITY, &out_archetype->edges.remove_edges);
 
-    // Manually set component_set data
+    // Manually set component_set data. Components with data are inserted first so their set index is also their column index.
+    u32 column_count = 0;
     for (u32 i = 0; i < component_count; i++) {
-        ecs_component_set_insert(&out_archetype->component_set, components[i]);
+        if (world->components.data[components[i]].stride > 0) {
+            ecs_component_set_insert(&out_archetype->component_set, components[i]);
+            column_count++;
+        }
+        ecs_signature_add(&out_archetype->signature, components[i]);
     }
-    out_archetype->component_set.count = component_count;
-
-    // Initialize all columns
     for (u32 i = 0; i < component_count; i++) {
-        ecs_component_t* component = &world->components.data[components[i]];
-        ecs_component_column_create(1, component->stride, &out_archetype->columns.data[i]);
+        if (world->components.data[components[i]].stride == 0) {
+            ecs_component_set_insert(&out_archetype->component_set, components[i]);
+        }
     }
-    out_archetype->columns.count = component_count;
+    out_archetype->component_set.count = component_count;
+    out_archetype->chunk_row_count = component_count > 0 ? entity_archetype_chunk_row_count(world, out_archetype) : 0;
 
-    // Check if archetype matches any existing queries
-    for (u32 i = 0; i < world->queries.count; i++) {
-        if (ecs_query_matches_archetype(&world->queries.data[i], out_archetype)) {
-            darray_u32_push(&world->queries.data[i].archetype_indices, out_archetype->archetype_id);
+    // Initialize all columns. Tags have none.
+    for (u32 i = 0; i < out_archetype->component_set.capacity; i++) {
+        ecs_component_id component_id = out_archetype->component_set.data[i].value;
+        u32 index = out_archetype->component_set.data[i].index;
+        if (component_id == INVALID_ID || index >= column_count) {
+            continue;
         }
+
+        ecs_component_t* component = &world->components.data[component_id];
+        ecs_component_column_create(1, component->stride, component->alignment, out_archetype->chunk_row_count, &out_archetype->columns.data[index]);
     }
+    out_archetype->columns.count = column_count;
+    entity_archetype_register_signature(world, out_archetype);
+    entity_archetype_match_queryies(out_archetype, world);
 }
 
 entity_archetype_t* entity_archetype_create_from_base(struct ecs_world* world, entity_archetype_t* base_archetype, u32 component_count, ecs_component_id* components) {
     u32 archetype_id = world->archetypes.count;
+    u32 base_archetype_id = base_archetype->archetype_id;
     entity_archetype_t* out_archetype = darray_entity_archetype_push(&world->archetypes, (entity_archetype_t) {});
     out_archetype->archetype_id = archetype_id;
 
+    // Pushing may have moved the world's archetypes
+    base_archetype = &world->archetypes.data[base_archetype_id];
+
     darray_entity_create(32, &out_archetype->entities);
+    darray_u64_create(1, &out_archetype->disabled_mask);
+    darray_entity_archetype_query_match_create(4, &out_archetype->query_matches);
 
     u32 total_component_count = component_count + base_archetype->component_set.count;
     if (total_component_count > 0) {
         darray_ecs_column_create(total_component_count, &out_archetype->columns);
     }
     ecs_component_set_create(smax(total_component_count, 1), &out_archetype->component_set);
-    entity_archetype_ptr_map_create(EDGE_MAP_DEFAULT_CAPACITY, &out_archetype->edges.add_edges);
-    entity_archetype_ptr_map_create(EDGE_MAP_DEFAULT_CAPACITY, &out_archetype->edges.remove_edges);
+    entity_archetype_edge_map_create(EDGE_MAP_DEFAULT_CAPACITY, &out_archetype->edges.add_edges);
+    entity_archetype_edge_map_create(EDGE_MAP_DEFAULT_CAPACITY, &out_archetype->edges.remove_edges);
 
-    // Manually set component_set data
-    for (u32 i = 0; i < base_archetype->component_set.capacity; i++) {
-        ecs_component_id component = base_archetype->component_set.data[i].value;
-        if (component == INVALID_ID) {
-            continue;
+    // Manually set component_set data. Components with data are inserted first so their set index is also their column index, and tags are inserted after them.
+    u32 column_count = 0;
+    for (u32 pass = 0; pass < 2; pass++) {
+        const b8 is_tag_pass = pass == 1;
+        for (u32 i = 0; i < base_archetype->component_set.capacity; i++) {
+            ecs_component_id component = base_archetype->component_set.data[i].value;
+            if (component == INVALID_ID || (world->components.data[component].stride == 0) != is_tag_pass) {
+                continue;
+            }
+            ecs_component_set_insert(&out_archetype->component_set, component);
+        }
+
+        for (u32 i = 0; i < component_count; i++) {
+            if ((world->components.data[components[i]].stride == 0) != is_tag_pass) {
+                continue;
+            }
+            ecs_component_set_insert(&out_archetype->component_set, components[i]);
+        }
+
+        if (!is_tag_pass) {
+            column_count = out_archetype->component_set.count;
         }
-        ecs_component_set_insert(&out_archetype->component_set, component);
     }
 
+    out_archetype->signature = base_archetype->signature;
     for (u32 i = 0; i < component_count; i++) {
-        ecs_component_set_insert(&out_archetype->component_set, components[i]);
+        ecs_signature_add(&out_archetype->signature, components[i]);
     }
 
-    // Initialize columns from base
+    out_archetype->chunk_row_count = entity_archetype_chunk_row_count(world, out_archetype);
+
+    // Initialize columns from base. Tags have none.
     for (u32 i = 0; i < out_archetype->component_set.capacity; i++) {
          u32 value = out_archetype->component_set.data[i].value;
          u32 index = out_archetype->component_set.data[i].index;
@@ -79,15 +147,28 @@ entity_archetype_t* entity_archetype_create_from_base(struct ecs_world* world, e
          }
 
          ecs_component_t* component = &world->components.data[value];
-         ecs_component_column_create(1, component->stride, &out_archetype->columns.data[index]);
+         if (index < column_count) {
+             ecs_component_column_create(1, component->stride, component->alignment, out_archetype->chunk_row_count, &out_archetype->columns.data[index]);
+         }
 
-         darray_entity_archetype_ptr_push(&component->archetypes, out_archetype);
+         darray_u32_push(&component->archetypes, out_archetype->archetype_id);
     }
 
-    out_archetype->columns.count = total_component_count;
+    out_archetype->columns.count = column_count;
+    entity_archetype_register_signature(world, out_archetype);
     return &world->archetypes.data[out_archetype->archetype_id];
 }
 
+static void entity_archetype_edge_map_destroy_targets(entity_archetype_edge_map_t* edges) {
+    for (u32 i = 0; i < edges->capacity * HASHMAP_MAX_LINKED_LIST_LENGTH; i++) {
+        entity_archetype_edge_target_t* target = &edges->linked_lists[i].value;
+        if (edges->linked_lists[i].hash != INVALID_ID_U64 && target->column_map) {
+            sfree(target->column_map, sizeof(u32) * target->column_count, MEMORY_TAG_ECS);
+        }
+    }
+    entity_archetype_edge_map_destroy(edges);
+}
+
 void entity_archetype_destroy(entity_archetype_t* archetype) {
     ecs_component_set_destroy(&archetype->component_set);
     if (archetype->columns.data) {
@@ -98,9 +179,132 @@ void entity_archetype_destroy(entity_archetype_t* archetype) {
         darray_ecs_column_destroy(&archetype->columns);
     }
 
-    entity_archetype_ptr_map_destroy(&archetype->edges.add_edges);
-    entity_archetype_ptr_map_destroy(&archetype->edges.remove_edges);
+    entity_archetype_edge_map_destroy_targets(&archetype->edges.add_edges);
+    entity_archetype_edge_map_destroy_targets(&archetype->edges.remove_edges);
     darray_entity_destroy(&archetype->entities);
+    darray_u64_destroy(&archetype->disabled_mask);
+    darray_entity_archetype_query_match_destroy(&archetype->query_matches);
+}
+
+entity_archetype_t* entity_archetype_get_or_create(struct ecs_world* world, u32 component_count, const ecs_component_id* components) {
+    if (component_count == 0) {
+        return &world->archetypes.data[0];
+    }
+
+    ecs_signature_t signature = {};
+    for (u32 i = 0; i < component_count; i++) {
+        SASSERT(world->components.data[components[i]].storage == ECS_STORAGE_TABLE, "Component '%s' is stored in a sparse set and cannot be part of an archetype.", world->components.data[components[i]].name);
+        ecs_signature_add(&signature, components[i]);
+    }
+
+    u32 archetype_id;
+    if (ecs_signature_map_try_get(&world->archetype_map, ecs_signature_hash(&signature), &archetype_id)) {
+        for (; archetype_id != INVALID_ID; archetype_id = world->archetypes.data[archetype_id].next_with_hash) {
+            if (ecs_signature_equals(&world->archetypes.data[archetype_id].signature, &signature)) {
+                return &world->archetypes.data[archetype_id];
+            }
+        }
+    }
+
+    entity_archetype_t* archetype = entity_archetype_create_from_base(world, &world->archetypes.data[0], component_count, (ecs_component_id*)components);
+    entity_archetype_match_queryies(archetype, world);
+    return archetype;
+}
+
+void entity_archetype_build_column_map(entity_archetype_t* source, entity_archetype_t* dest, u32* out_column_map) {
+    for (u32 i = 0; i < dest->component_set.capacity; i++) {
+        ecs_component_id component = dest->component_set.data[i].value;
+        if (component == INVALID_ID || dest->component_set.data[i].index >= dest->columns.count) {
+            continue;
+        }
+
+        out_column_map[dest->component_set.data[i].index] = ecs_component_set_contains(&source->component_set, component) ?
+            ecs_component_set_get_index(&source->component_set, component) : INVALID_ID;
+    }
+}
+
+static void entity_archetype_insert_edge(entity_archetype_edge_map_t* edges, ecs_component_id component, entity_archetype_t* source, entity_archetype_t* dest) {
+    if (entity_archetype_edge_map_contains(edges, component)) {
+        return;
+    }
+
+    entity_archetype_edge_target_t target = {
+        .archetype_id = dest->archetype_id,
+        .column_map = NULL,
+        .column_count = dest->columns.count,
+    };
+    if (target.column_count > 0) {
+        target.column_map = sallocate(sizeof(u32) * target.column_count, MEMORY_TAG_ECS);
+        entity_archetype_build_column_map(source, dest, target.column_map);
+    }
+    entity_archetype_edge_map_insert(edges, component, target);
+}
+
+void entity_archetype_connect(struct ecs_world* world, u32 archetype_id, u32 added_archetype_id, ecs_component_id component) {
+    entity_archetype_t* archetype = &world->archetypes.data[archetype_id];
+    entity_archetype_t* added_archetype = &world->archetypes.data[added_archetype_id];
+
+    entity_archetype_insert_edge(&archetype->edges.add_edges, component, archetype, added_archetype);
+    entity_archetype_insert_edge(&added_archetype->edges.remove_edges, component, added_archetype, archetype);
+}
+
+void entity_archetype_reserve(entity_archetype_t* archetype, u32 row_count) {
+    if (row_count == 0) {
+        return;
+    }
+
+    u32 required_count = archetype->entities.count + row_count;
+    darray_entity_reserve(&archetype->entities, required_count);
+    for (u32 i = 0; i < archetype->columns.count; i++) {
+        ecs_component_column_resize(&archetype->columns.data[i], required_count);
+    }
+}
+
+void entity_archetype_remove_row(struct ecs_world* world, entity_archetype_t* archetype, ecs_index row) {
+    SASSERT(row < archetype->entities.count, "Cannot remove row %d from archetype %d with %d entities.", row, archetype->archetype_id, archetype->entities.count);
+
+    for (u32 i = 0; i < archetype->columns.count; i++) {
+        ecs_component_column_pop(&archetype->columns.data[i], row);
+    }
+
+    // Move the last entity into the removed row
+    u32 last_row = archetype->entities.count - 1;
+    if (archetype->disabled_count > 0) {
+        // Rows past the end are always enabled, and the last row's state moves with its entity
+        b8 is_last_row_enabled = entity_archetype_row_enabled(archetype, last_row);
+        entity_archetype_set_row_enabled(archetype, last_row, true);
+        if (row != last_row) {
+            entity_archetype_set_row_enabled(archetype, row, is_last_row_enabled);
+        }
+    }
+    if (row != last_row) {
+        entity_t moved_entity = archetype->entities.data[last_row];
+        archetype->entities.data[row] = moved_entity;
+        world->records.data[ENTITY_INDEX(moved_entity)].index = row;
+    }
+    archetype->entities.count--;
+    if (archetype->entities.count == 0) {
+        entity_archetype_update_queries(archetype);
+    }
+}
+
+void entity_archetype_set_row_enabled(entity_archetype_t* archetype, ecs_index row, b8 enabled) {
+    if (entity_archetype_row_enabled(archetype, row) == enabled) {
+        return;
+    }
+
+    u32 word = row / 64;
+    if (word >= archetype->disabled_mask.count) {
+        // Grow the mask to cover the row. New words are all enabled.
+        if (word >= archetype->disabled_mask.capacity) {
+            darray_u64_reserve(&archetype->disabled_mask, smax(archetype->disabled_mask.capacity * 2, word + 1));
+        }
+        szero_memory(archetype->disabled_mask.data + archetype->disabled_mask.count, sizeof(u64) * (word + 1 - archetype->disabled_mask.count));
+        archetype->disabled_mask.count = word + 1;
+    }
+
+    archetype->disabled_mask.data[word] ^= 1ULL << (row % 64);
+    archetype->disabled_count += enabled ? -1 : 1;
 }
 
 void entity_archetype_print_debug(entity_archetype_t* archetype) {
@@ -114,11 +318,30 @@ void entity_archetype_print_debug(entity_archetype_t* archetype) {
 }
 
 
+// Adds an archetype to every query in a list that matches it
+static void entity_archetype_match_query_list(entity_archetype_t* archetype, darray_ecs_query_ptr_t* queries) {
+    for (u32 i = 0; i < queries->count; i++) {
+        if (ecs_query_matches_archetype(queries->data[i], archetype)) {
+            ecs_query_add_archetype(queries->data[i], archetype);
+        }
+    }
+}
+
 void entity_archetype_match_queryies(entity_archetype_t *archetype, struct ecs_world *world) {
-    // Check if archetype matches any existing queries
-    for (u32 i = 0; i < world->queries.count; i++) {
-        if (ecs_query_matches_archetype(&world->queries.data[i], archetype)) {
-            darray_u32_push(&world->queries.data[i].archetype_indices, archetype->archetype_id);
+    // Every query is indexed under one component it requires, so only queries indexed under the archetype's components can match it
+    for (u32 i = 0; i < archetype->component_set.capacity; i++) {
+        ecs_component_id component = archetype->component_set.data[i].value;
+        if (component != INVALID_ID) {
+            entity_archetype_match_query_list(archetype, &world->components.data[component].queries);
         }
     }
+    entity_archetype_match_query_list(archetype, &world->unindexed_queries);
+}
+
+void entity_archetype_update_queries(entity_archetype_t* archetype) {
+    const b8 is_non_empty = archetype->entities.count > 0;
+    for (u32 i = 0; i < archetype->query_matches.count; i++) {
+        entity_archetype_query_match_t* match = &archetype->query_matches.data[i];
+        ecs_query_set_archetype_non_empty(match->query, match->match_index, is_non_empty);
+    }
 }
@@ -0,0 +1,1792 @@
+#include "OECS/defines.h"
+#include "OECS/core/logging.h"
+#include "OECS/core/smemory.h"
+#include "OECS/math.h"
+
+#include "OECS/ecs/ecs.h"
+#include "OECS/ecs/ecs_command_buffer.h"
+#include "OECS/ecs/ecs_world.h"
+#include "OECS/ecs/entity.h"
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+// Logs the failed check and fails the current test
+#define TEST_EXPECT(cond, ...) if (!(cond)) { SERROR("Check '" #cond "' failed: " __VA_ARGS__); SERROR("\t\t" __FILE__ ":%i", __LINE__); return false; }
+
+typedef struct position {
+    f32 x;
+    f32 y;
+} position_t;
+ECS_COMPONENT_DECLARE(position_t);
+
+typedef struct stunned {
+    u32 frames;
+} stunned_t;
+ECS_COMPONENT_DECLARE(stunned_t);
+
+typedef struct test_velocity {
+    f32 x;
+    f32 y;
+} test_velocity_t;
+ECS_COMPONENT_DECLARE(test_velocity_t);
+
+typedef struct health {
+    f32 value;
+} health_t;
+ECS_COMPONENT_DECLARE(health_t);
+
+typedef struct armor {
+    f32 value;
+} armor_t;
+ECS_COMPONENT_DECLARE(armor_t);
+
+typedef struct game_time {
+    u32 frame;
+} game_time_t;
+ECS_COMPONENT_DECLARE(game_time_t);
+
+/**
+ * @brief A component whose alignment is larger than a cache line.
+ */
+typedef struct wide {
+    _Alignas(128) f32 values[4];
+} wide_t;
+ECS_COMPONENT_DECLARE(wide_t);
+
+/**
+ * @brief A component whose stride is not a multiple of any alignment, so a column is only aligned if its allocation is.
+ */
+typedef struct odd {
+    u8 bytes[3];
+} odd_t;
+ECS_COMPONENT_DECLARE(odd_t);
+
+// Creates a world with position_t, test_velocity_t, health_t and armor_t defined
+static ecs_world_t* test_world_create() {
+    ecs_world_t* world = ecs_world_initialize();
+    ECS_COMPONENT_DEFINE(world, position_t);
+    ECS_COMPONENT_DEFINE(world, test_velocity_t);
+    ECS_COMPONENT_DEFINE(world, health_t);
+    ECS_COMPONENT_DEFINE(world, armor_t);
+    return world;
+}
+
+// Returns the archetype an entity is in. Only valid until the next archetype is created.
+static entity_archetype_t* test_get_archetype(ecs_world_t* world, entity_t entity) {
+    return &world->archetypes.data[world->records.data[ENTITY_INDEX(entity)].archetype_index];
+}
+
+/**
+ * @brief The number of worker threads parallel tests run with, so they run concurrently regardless of the machine's core count.
+ */
+#define TEST_WORKER_COUNT 3
+
+/**
+ * @brief Storage tests are run once per chunk size, starting with contiguous columns. The smallest sizes fit a single row per chunk.
+ */
+static const u32 test_chunk_sizes[] = { 0, ECS_DEFAULT_CHUNK_SIZE, 64, 8, 1 };
+#define TEST_CHUNK_SIZE_COUNT (sizeof(test_chunk_sizes) / sizeof(test_chunk_sizes[0]))
+
+// ================================
+// Entities
+// ================================
+b8 entity_recycling_test() {
+    ecs_world_t* world = test_world_create();
+
+    entity_t first = entity_create(world);
+    ENTITY_SET_COMPONENT(world, first, position_t, { .x = 1 });
+    entity_t second = entity_create(world);
+    ENTITY_SET_COMPONENT(world, second, position_t, { .x = 2 });
+
+    entity_destroy(world, first);
+    TEST_EXPECT(!entity_is_alive(world, first), "Destroyed entity is still alive.");
+    TEST_EXPECT(entity_is_alive(world, second), "Destroying an entity killed another entity.");
+    TEST_EXPECT(world->entity_count == 1, "Expected 1 entity, got %d", world->entity_count);
+
+    // Destroying the first entity moved the second into its row
+    TEST_EXPECT((ENTITY_GET_COMPONENT(world, second, position_t))->x == 2, "Entity lost its component when another entity was destroyed.");
+
+    // The index is reused with a new generation, so the old handle stays dead
+    entity_t recycled = entity_create(world);
+    TEST_EXPECT(ENTITY_INDEX(recycled) == ENTITY_INDEX(first), "Destroyed entity index was not reused.");
+    TEST_EXPECT(ENTITY_GENERATION(recycled) != ENTITY_GENERATION(first), "Recycled entity has the same generation as the destroyed one.");
+    TEST_EXPECT(entity_is_alive(world, recycled), "Recycled entity is not alive.");
+    TEST_EXPECT(!entity_is_alive(world, first), "Destroyed handle became alive again when its index was reused.");
+    TEST_EXPECT(!ENTITY_HAS_COMPONENT(world, recycled, position_t), "Recycled entity kept the destroyed entity's components.");
+
+    // Destroying a dead handle must not touch the entity that reused its index
+    entity_destroy(world, first);
+    TEST_EXPECT(entity_is_alive(world, recycled), "Destroying a stale handle destroyed the entity reusing its index.");
+
+    ecs_world_shutdown(world);
+    return true;
+}
+
+// Bulk creates entities twice, so the second batch is appended to existing rows, and checks every entity's components
+static b8 test_create_bulk(ecs_world_t* world) {
+    const u32 entity_count = 1000;
+    position_t positions[entity_count];
+    for (u32 i = 0; i < entity_count; i++) {
+        positions[i] = (position_t) { .x = i, .y = -(f32)i };
+    }
+
+    ecs_component_id components[] = { ECS_COMPONENT_ID(position_t), ECS_COMPONENT_ID(test_velocity_t) };
+    const void* initial_data[] = { positions, NULL };
+    entity_t entities[2 * entity_count];
+    for (u32 batch = 0; batch < 2; batch++) {
+        const entity_t* created = entity_create_bulk(world, entity_count, components, 2, initial_data);
+        memcpy(entities + batch * entity_count, created, sizeof(entity_t) * entity_count);
+    }
+    TEST_EXPECT(world->entity_count == 2 * entity_count, "Expected %d entities, got %d", 2 * entity_count, world->entity_count);
+
+    for (u32 i = 0; i < 2 * entity_count; i++) {
+        TEST_EXPECT(entity_is_alive(world, entities[i]), "Bulk created entity %d is not alive.", i);
+        position_t* position = ENTITY_GET_COMPONENT(world, entities[i], position_t);
+        test_velocity_t* velocity = ENTITY_GET_COMPONENT(world, entities[i], test_velocity_t);
+        TEST_EXPECT(position->x == i % entity_count && position->y == -(f32)(i % entity_count), "Entity %d has position (%f, %f)", i, position->x, position->y);
+        TEST_EXPECT(velocity->x == 0 && velocity->y == 0, "Entity %d velocity was not zeroed.", i);
+    }
+    return true;
+}
+
+b8 entity_create_bulk_test() {
+    ecs_world_t* world = test_world_create();
+    if (!test_create_bulk(world)) {
+        return false;
+    }
+
+    ecs_world_shutdown(world);
+    return true;
+}
+
+b8 entity_remove_component_test() {
+    ecs_world_t* world = test_world_create();
+    const u32 entity_count = 100;
+    entity_t entities[entity_count];
+    for (u32 i = 0; i < entity_count; i++) {
+        entities[i] = entity_create(world);
+        ENTITY_SET_COMPONENT(world, entities[i], position_t, { .x = i });
+        ENTITY_SET_COMPONENT(world, entities[i], test_velocity_t, { .x = i * 2 });
+        ENTITY_SET_COMPONENT(world, entities[i], health_t, { .value = i * 3 });
+        ENTITY_SET_COMPONENT(world, entities[i], armor_t, { .value = i * 4 });
+    }
+
+    // Each removal moves the last row of the archetype into the gap, which must keep every other component of both entities
+    for (u32 i = 0; i < entity_count; i++) {
+        if (i % 2 == 0) {
+            ENTITY_REMOVE_COMPONENT(world, entities[i], test_velocity_t);
+        }
+        if (i % 3 == 0) {
+            ENTITY_REMOVE_COMPONENT(world, entities[i], position_t);
+        }
+    }
+
+    // Removing a component the entity does not have is a no-op
+    entity_archetype_t* archetype = test_get_archetype(world, entities[0]);
+    ENTITY_REMOVE_COMPONENT(world, entities[0], test_velocity_t);
+    TEST_EXPECT(test_get_archetype(world, entities[0]) == archetype, "Removing a missing component moved the entity.");
+
+    for (u32 i = 0; i < entity_count; i++) {
+        TEST_EXPECT(ENTITY_HAS_COMPONENT(world, entities[i], test_velocity_t) == (i % 2 != 0), "Entity %d has the wrong velocity.", i);
+        TEST_EXPECT(ENTITY_HAS_COMPONENT(world, entities[i], position_t) == (i % 3 != 0), "Entity %d has the wrong position.", i);
+        if (i % 2 != 0) {
+            TEST_EXPECT((ENTITY_GET_COMPONENT(world, entities[i], test_velocity_t))->x == i * 2, "Entity %d lost its velocity.", i);
+        }
+        if (i % 3 != 0) {
+            position_t* position = ENTITY_GET_COMPONENT(world, entities[i], position_t);
+            TEST_EXPECT(position->x == i, "Entity %d has position %f", i, position->x);
+        }
+        TEST_EXPECT((ENTITY_GET_COMPONENT(world, entities[i], health_t))->value == i * 3, "Entity %d lost its health.", i);
+        TEST_EXPECT((ENTITY_GET_COMPONENT(world, entities[i], armor_t))->value == i * 4, "Entity %d lost its armor.", i);
+    }
+
+    // The first removal from an archetype leaves an edge for the ones after it
+    entity_archetype_t* full_archetype = test_get_archetype(world, entities[1]);
+    TEST_EXPECT(entity_archetype_edge_map_contains(&full_archetype->edges.remove_edges, ECS_COMPONENT_ID(position_t)), "Removing a component did not cache the remove edge.");
+
+    ecs_world_shutdown(world);
+    return true;
+}
+
+// ================================
+// Archetypes
+// ================================
+b8 archetype_edge_column_map_test() {
+    ecs_world_t* world = test_world_create();
+    entity_t entity = entity_create(world);
+    ENTITY_SET_COMPONENT(world, entity, position_t, { .x = 1 });
+    ENTITY_SET_COMPONENT(world, entity, health_t, { .value = 3 });
+    ENTITY_SET_COMPONENT(world, entity, armor_t, { .value = 4 });
+    u32 source_id = test_get_archetype(world, entity)->archetype_id;
+
+    // Adding a component can move the columns around it, so every column is checked against the one holding the same component
+    ENTITY_SET_COMPONENT(world, entity, test_velocity_t, { .x = 5 });
+    u32 target_id = test_get_archetype(world, entity)->archetype_id;
+    entity_archetype_t* source = &world->archetypes.data[source_id];
+    entity_archetype_t* target = &world->archetypes.data[target_id];
+
+    ecs_component_id components[] = { ECS_COMPONENT_ID(position_t), ECS_COMPONENT_ID(test_velocity_t), ECS_COMPONENT_ID(health_t), ECS_COMPONENT_ID(armor_t) };
+    entity_archetype_edge_target_t add_edge;
+    TEST_EXPECT(entity_archetype_edge_map_try_get(&source->edges.add_edges, ECS_COMPONENT_ID(test_velocity_t), &add_edge), "Adding a component did not leave an add edge.");
+    TEST_EXPECT(add_edge.archetype_id == target_id, "Add edge leads to archetype %d instead of %d", add_edge.archetype_id, target_id);
+    TEST_EXPECT(add_edge.column_count == 4, "Add edge maps %d columns, expected 4", add_edge.column_count);
+    for (u32 i = 0; i < 4; i++) {
+        u32 target_column = ecs_component_set_get_index(&target->component_set, components[i]);
+        u32 expected = components[i] == ECS_COMPONENT_ID(test_velocity_t) ? INVALID_ID : ecs_component_set_get_index(&source->component_set, components[i]);
+        TEST_EXPECT(add_edge.column_map[target_column] == expected, "Add edge maps component %d from column %d, expected %d", components[i], add_edge.column_map[target_column], expected);
+    }
+
+    // The remove edge leads back and maps every column of the smaller archetype
+    entity_archetype_edge_target_t remove_edge;
+    TEST_EXPECT(entity_archetype_edge_map_try_get(&target->edges.remove_edges, ECS_COMPONENT_ID(test_velocity_t), &remove_edge), "Adding a component did not leave a remove edge back.");
+    TEST_EXPECT(remove_edge.archetype_id == source_id, "Remove edge leads to archetype %d instead of %d", remove_edge.archetype_id, source_id);
+    TEST_EXPECT(remove_edge.column_count == 3, "Remove edge maps %d columns, expected 3", remove_edge.column_count);
+    for (u32 i = 0; i < 4; i++) {
+        if (components[i] == ECS_COMPONENT_ID(test_velocity_t)) {
+            continue;
+        }
+        u32 source_column = ecs_component_set_get_index(&source->component_set, components[i]);
+        u32 expected = ecs_component_set_get_index(&target->component_set, components[i]);
+        TEST_EXPECT(remove_edge.column_map[source_column] == expected, "Remove edge maps component %d from column %d, expected %d", components[i], remove_edge.column_map[source_column], expected);
+    }
+
+    // Moving along both edges keeps every value
+    ENTITY_REMOVE_COMPONENT(world, entity, test_velocity_t);
+    TEST_EXPECT(test_get_archetype(world, entity)->archetype_id == source_id, "Removing the component did not move the entity back.");
+    position_t* position = ENTITY_GET_COMPONENT(world, entity, position_t);
+    TEST_EXPECT(position->x == 1, "Position is %f after moving along both edges", position->x);
+    TEST_EXPECT((ENTITY_GET_COMPONENT(world, entity, health_t))->value == 3, "Health changed after moving along both edges.");
+    TEST_EXPECT((ENTITY_GET_COMPONENT(world, entity, armor_t))->value == 4, "Armor changed after moving along both edges.");
+
+    ecs_world_shutdown(world);
+    return true;
+}
+
+b8 archetype_signature_lookup_test() {
+    ecs_world_t* world = test_world_create();
+    entity_t first = entity_create(world);
+    ENTITY_ADD_COMPONENT(world, first, position_t);
+    ENTITY_ADD_COMPONENT(world, first, test_velocity_t);
+    u32 archetype_count = world->archetypes.count;
+
+    // Adding the components in the other order misses every edge out of the velocity archetype, but must still find the existing archetype
+    entity_t second = entity_create(world);
+    ENTITY_ADD_COMPONENT(world, second, test_velocity_t);
+    u32 velocity_archetype_id = test_get_archetype(world, second)->archetype_id;
+    TEST_EXPECT(world->archetypes.count == archetype_count + 1, "Expected 1 new archetype, got %d", world->archetypes.count - archetype_count);
+    ENTITY_ADD_COMPONENT(world, second, position_t);
+    TEST_EXPECT(world->archetypes.count == archetype_count + 1, "Adding components in a different order created a duplicate archetype.");
+    TEST_EXPECT(test_get_archetype(world, second) == test_get_archetype(world, first), "Entities with the same components are in different archetypes.");
+    TEST_EXPECT(entity_archetype_edge_map_contains(&world->archetypes.data[velocity_archetype_id].edges.add_edges, ECS_COMPONENT_ID(position_t)), "The edge found through the signature map was not cached.");
+
+    // The same holds when removing
+    entity_t third = entity_create(world);
+    ENTITY_ADD_COMPONENT(world, third, test_velocity_t);
+    ENTITY_ADD_COMPONENT(world, third, health_t);
+    ENTITY_ADD_COMPONENT(world, third, position_t);
+    archetype_count = world->archetypes.count;
+    ENTITY_REMOVE_COMPONENT(world, third, health_t);
+    TEST_EXPECT(world->archetypes.count == archetype_count, "Removing a component created a duplicate archetype.");
+    TEST_EXPECT(test_get_archetype(world, third) == test_get_archetype(world, first), "Entity did not move into the existing archetype.");
+
+    ecs_world_shutdown(world);
+    return true;
+}
+
+// Checks that every column of an archetype starts on its alignment
+static b8 test_columns_aligned(entity_archetype_t* archetype) {
+    for (u32 i = 0; i < archetype->columns.count; i++) {
+        ecs_column_t* column = &archetype->columns.data[i];
+        TEST_EXPECT(column->alignment % ECS_COLUMN_ALIGNMENT == 0, "Column %d has alignment %d", i, column->alignment);
+        TEST_EXPECT((u64)ecs_component_column_get(column, 0) % column->alignment == 0, "Column %d data %p is not aligned to %d", i, ecs_component_column_get(column, 0), column->alignment);
+    }
+    return true;
+}
+
+b8 column_alignment_test() {
+    ecs_world_t* world = test_world_create();
+    ECS_COMPONENT_DEFINE(world, odd_t);
+    ECS_COMPONENT_DEFINE(world, wide_t);
+    TEST_EXPECT(world->components.data[ECS_COMPONENT_ID(wide_t)].alignment == _Alignof(wide_t), "Expected alignment %d to be recorded, got %d", (u32)_Alignof(wide_t), world->components.data[ECS_COMPONENT_ID(wide_t)].alignment);
+
+    // Columns grow by reallocating, which must keep them aligned
+    const u32 entity_count = 1000;
+    for (u32 i = 0; i < entity_count; i++) {
+        entity_t entity = entity_create(world);
+        ENTITY_ADD_COMPONENT(world, entity, odd_t);
+        ENTITY_ADD_COMPONENT(world, entity, position_t);
+        ENTITY_ADD_COMPONENT(world, entity, wide_t);
+        entity_archetype_t* archetype = test_get_archetype(world, entity);
+        if (!test_columns_aligned(archetype)) {
+            SERROR("Columns not aligned after %d entities", i + 1);
+            return false;
+        }
+
+        ecs_column_t* wide_column = &archetype->columns.data[ecs_component_set_get_index(&archetype->component_set, ECS_COMPONENT_ID(wide_t))];
+        TEST_EXPECT(wide_column->alignment == _Alignof(wide_t), "Column of a component aligned past a cache line has alignment %d", wide_column->alignment);
+    }
+
+    ecs_world_shutdown(world);
+    return true;
+}
+
+ECS_COMPONENT_DECLARE(test_tag);
+
+static b8 tag_ranges_valid;
+static u32 tag_visited_count;
+
+// Counts the entities of a (position_t, test_tag) query and checks that only position_t has data
+static void check_tag_range(ecs_iterator_t* iterator) {
+    tag_ranges_valid &= iterator->component_data[0] != NULL && iterator->component_data[1] == NULL;
+    tag_visited_count += iterator->entity_count;
+}
+
+b8 tag_components_test() {
+    ecs_world_t* world = test_world_create();
+    ECS_TAG_DEFINE(world, test_tag);
+    const u32 entity_count = 100;
+    entity_t entities[entity_count];
+    for (u32 i = 0; i < entity_count; i++) {
+        entities[i] = entity_create(world);
+        ENTITY_SET_COMPONENT(world, entities[i], position_t, { .x = i });
+    }
+    u32 untagged_archetype_id = test_get_archetype(world, entities[0])->archetype_id;
+    for (u32 i = 0; i < entity_count; i += 2) {
+        ENTITY_ADD_COMPONENT(world, entities[i], test_tag);
+    }
+
+    // Tags are part of the archetype's components but have no column
+    entity_archetype_t* archetype = test_get_archetype(world, entities[0]);
+    TEST_EXPECT(ENTITY_HAS_COMPONENT(world, entities[0], test_tag), "Tag was not added.");
+    TEST_EXPECT(archetype->component_set.count == 2, "Expected 2 components in the tagged archetype, got %d", archetype->component_set.count);
+    TEST_EXPECT(archetype->columns.count == 1, "Expected 1 column in the tagged archetype, got %d", archetype->columns.count);
+    TEST_EXPECT(entity_archetype_get_column(archetype, ECS_COMPONENT_ID(test_tag)) == NULL, "Tag has a column.");
+
+    // Transitions only map the columns with data
+    entity_archetype_edge_target_t edge;
+    TEST_EXPECT(entity_archetype_edge_map_try_get(&world->archetypes.data[untagged_archetype_id].edges.add_edges, ECS_COMPONENT_ID(test_tag), &edge), "Adding a tag did not leave an add edge.");
+    TEST_EXPECT(edge.column_count == 1, "Tag edge maps %d columns, expected 1", edge.column_count);
+    for (u32 i = 0; i < entity_count; i++) {
+        TEST_EXPECT((ENTITY_GET_COMPONENT(world, entities[i], position_t))->x == i, "Entity %d lost its position when a tag was added.", i);
+    }
+
+    // Tags still match queries, without adding data to the iterator
+    ecs_component_id position_tag[] = { ECS_COMPONENT_ID(position_t), ECS_COMPONENT_ID(test_tag) };
+    ecs_query_t* tagged_query = ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 2, .components = position_tag });
+    tag_ranges_valid = true;
+    tag_visited_count = 0;
+    ecs_query_iterate(tagged_query, check_tag_range);
+    TEST_EXPECT(tag_ranges_valid, "A tag query range has data for the tag or none for position_t.");
+    TEST_EXPECT(tag_visited_count == entity_count / 2, "Expected %d tagged entities, got %d", entity_count / 2, tag_visited_count);
+
+    ENTITY_REMOVE_COMPONENT(world, entities[0], test_tag);
+    tag_visited_count = 0;
+    ecs_query_iterate(tagged_query, check_tag_range);
+    TEST_EXPECT(tag_visited_count == entity_count / 2 - 1, "Expected %d tagged entities after removing a tag, got %d", entity_count / 2 - 1, tag_visited_count);
+    TEST_EXPECT((ENTITY_GET_COMPONENT(world, entities[0], position_t))->x == 0, "Entity lost its position when a tag was removed.");
+
+    ecs_world_shutdown(world);
+    return true;
+}
+
+// ================================
+// Storage
+// ================================
+static u32 chunked_visited_count;
+static b8 chunked_ranges_valid;
+
+// Checks that each entity's components are at the rows the range says they are
+static void check_chunked_range(ecs_iterator_t* iterator) {
+    position_t* positions = ECS_ITERATOR_GET_COMPONENTS(iterator, 0);
+    test_velocity_t* velocities = ECS_ITERATOR_GET_COMPONENTS(iterator, 1);
+    for (u32 i = 0; i < iterator->entity_count; i++) {
+        entity_t entity = iterator->entities[i];
+        chunked_ranges_valid &= (ENTITY_GET_COMPONENT(iterator->world, entity, position_t)) == &positions[i];
+        chunked_ranges_valid &= (ENTITY_GET_COMPONENT(iterator->world, entity, test_velocity_t)) == &velocities[i];
+        chunked_ranges_valid &= velocities[i].x == positions[i].x * 2;
+    }
+    chunked_visited_count += iterator->entity_count;
+}
+
+// Checks that every chunk of every column of an archetype starts on the column's alignment
+static b8 test_chunks_aligned(entity_archetype_t* archetype) {
+    for (u32 i = 0; i < archetype->columns.count; i++) {
+        ecs_column_t* column = &archetype->columns.data[i];
+        for (u32 row = 0; row < column->capacity; row += column->chunk_row_count) {
+            TEST_EXPECT((u64)ecs_component_column_get(column, row) % column->alignment == 0, "Chunk at row %d of column %d is not aligned to %d", row, i, column->alignment);
+        }
+    }
+    return true;
+}
+
+b8 chunked_storage_test() {
+    for (u32 c = 0; c < TEST_CHUNK_SIZE_COUNT; c++) {
+        const u32 chunk_size = test_chunk_sizes[c];
+        ecs_world_t* world = test_world_create();
+        ecs_world_set_chunk_size(world, chunk_size);
+        const u32 entity_count = 5000;
+        entity_t entities[entity_count];
+        for (u32 i = 0; i < entity_count; i++) {
+            entities[i] = entity_create(world);
+            ENTITY_SET_COMPONENT(world, entities[i], position_t, { .x = i });
+            ENTITY_SET_COMPONENT(world, entities[i], test_velocity_t, { .x = i * 2 });
+        }
+        position_t* first_position = ENTITY_GET_COMPONENT(world, entities[0], position_t);
+
+        // Growing a chunked archetype never moves existing rows, and every new chunk is aligned
+        for (u32 i = 0; i < entity_count; i++) {
+            entity_t entity = entity_create(world);
+            ENTITY_ADD_COMPONENT(world, entity, position_t);
+            ENTITY_ADD_COMPONENT(world, entity, test_velocity_t);
+        }
+        if (chunk_size > 0) {
+            TEST_EXPECT((ENTITY_GET_COMPONENT(world, entities[0], position_t)) == first_position, "Chunk size %d: growing the archetype moved an existing component.", chunk_size);
+            if (!test_chunks_aligned(test_get_archetype(world, entities[0]))) {
+                SERROR("Chunk size %d: chunks are not aligned", chunk_size);
+                return false;
+            }
+        }
+
+        // Removing rows moves the last row of the archetype across chunks into the gap. The zeroed entities added above are never removed.
+        u32 remaining_count = entity_count;
+        for (u32 i = 0; i < entity_count; i++) {
+            if (i % 5 == 0) {
+                entity_destroy(world, entities[i]);
+            } else if (i % 3 == 0) {
+                ENTITY_REMOVE_COMPONENT(world, entities[i], test_velocity_t);
+            } else {
+                remaining_count++;
+            }
+        }
+        for (u32 i = 0; i < entity_count; i++) {
+            if (i % 5 == 0) {
+                continue;
+            }
+            position_t* position = ENTITY_GET_COMPONENT(world, entities[i], position_t);
+            TEST_EXPECT(position->x == i, "Chunk size %d: entity %d has position %f", chunk_size, i, position->x);
+            if (i % 3 != 0) {
+                test_velocity_t* velocity = ENTITY_GET_COMPONENT(world, entities[i], test_velocity_t);
+                TEST_EXPECT(velocity->x == i * 2, "Chunk size %d: entity %d has velocity %f", chunk_size, i, velocity->x);
+            }
+        }
+
+        // Ranges never cross a chunk boundary, so indexing a range's arrays gives each entity's components
+        ecs_component_id components[] = { ECS_COMPONENT_ID(position_t), ECS_COMPONENT_ID(test_velocity_t) };
+        ecs_query_t* query = ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 2, .components = components });
+        chunked_visited_count = 0;
+        chunked_ranges_valid = true;
+        ecs_query_iterate(query, check_chunked_range);
+        TEST_EXPECT(chunked_ranges_valid, "Chunk size %d: a range's component arrays did not match its entities.", chunk_size);
+        TEST_EXPECT(chunked_visited_count == remaining_count, "Chunk size %d: expected %d entities, visited %d", chunk_size, remaining_count, chunked_visited_count);
+        ecs_world_shutdown(world);
+
+        // Bulk creation fills chunks one run of rows at a time
+        world = test_world_create();
+        ecs_world_set_chunk_size(world, chunk_size);
+        if (!test_create_bulk(world)) {
+            SERROR("Chunk size %d: bulk creation failed", chunk_size);
+            return false;
+        }
+        ecs_world_shutdown(world);
+    }
+    return true;
+}
+
+static u32 changed_visited_count;
+
+static void count_changed(ecs_iterator_t* iterator) {
+    changed_visited_count += iterator->entity_count;
+}
+
+// Visits every entity without changing anything, so writes are only marked through the write mask
+static void write_nothing(ecs_iterator_t* iterator) {
+    (void)iterator;
+}
+
+// Returns the change tick of an entity's table component
+static u32* test_get_change_tick(ecs_world_t* world, entity_t entity, ecs_component_id component) {
+    entity_record_t record = world->records.data[ENTITY_INDEX(entity)];
+    ecs_column_t* column = entity_archetype_get_column(&world->archetypes.data[record.archetype_index], component);
+    return ecs_component_column_get_change_tick(column, record.index);
+}
+
+b8 changed_ticks_test() {
+    for (u32 c = 0; c < TEST_CHUNK_SIZE_COUNT; c++) {
+        const u32 chunk_size = test_chunk_sizes[c];
+        ecs_world_t* world = test_world_create();
+        ecs_world_set_chunk_size(world, chunk_size);
+        const u32 entity_count = 3000;
+        entity_t entities[entity_count];
+        for (u32 i = 0; i < entity_count; i++) {
+            entities[i] = entity_create(world);
+            ENTITY_ADD_COMPONENT(world, entities[i], position_t);
+            ENTITY_ADD_COMPONENT(world, entities[i], test_velocity_t);
+        }
+
+        // Growing chunked storage must not move the ticks of existing rows any more than their components
+        u32* first_tick = test_get_change_tick(world, entities[0], ECS_COMPONENT_ID(position_t));
+        for (u32 i = 0; i < entity_count; i++) {
+            entity_t entity = entity_create(world);
+            ENTITY_ADD_COMPONENT(world, entity, position_t);
+            ENTITY_ADD_COMPONENT(world, entity, test_velocity_t);
+        }
+        const u32 total_count = 2 * entity_count;
+        if (chunk_size > 0) {
+            TEST_EXPECT(test_get_change_tick(world, entities[0], ECS_COMPONENT_ID(position_t)) == first_tick, "Chunk size %d: growing the archetype moved an existing change tick.", chunk_size);
+        }
+
+        ecs_component_id changed[] = { ECS_COMPONENT_ID(position_t) };
+        ecs_query_t* changed_query = ecs_query_create(world, &(ecs_query_create_info_t) { .changed_component_count = 1, .changed_components = changed });
+
+        // Every row counts as changed the first time, and none the second
+        changed_visited_count = 0;
+        ecs_query_iterate(changed_query, count_changed);
+        TEST_EXPECT(changed_visited_count == total_count, "Chunk size %d: expected %d changed entities on the first pass, got %d", chunk_size, total_count, changed_visited_count);
+        changed_visited_count = 0;
+        ecs_query_iterate(changed_query, count_changed);
+        TEST_EXPECT(changed_visited_count == 0, "Chunk size %d: expected no changed entities on the second pass, got %d", chunk_size, changed_visited_count);
+
+        // Sets, explicit marks and writes declared through a write mask are changes
+        u32 expected_count = 0;
+        for (u32 i = 0; i < entity_count; i++) {
+            if (i % 7 == 0) {
+                ENTITY_SET_COMPONENT(world, entities[i], position_t, { .x = i });
+                expected_count++;
+            } else if (i % 11 == 0) {
+                ENTITY_MARK_CHANGED(world, entities[i], position_t);
+                expected_count++;
+            } else if (i % 13 == 0) {
+                ENTITY_SET_COMPONENT(world, entities[i], test_velocity_t, { .x = i });
+            }
+        }
+        changed_visited_count = 0;
+        ecs_query_iterate(changed_query, count_changed);
+        TEST_EXPECT(changed_visited_count == expected_count, "Chunk size %d: expected %d changed entities, got %d", chunk_size, expected_count, changed_visited_count);
+
+        ecs_component_id written[] = { ECS_COMPONENT_ID(test_velocity_t), ECS_COMPONENT_ID(position_t) };
+        ecs_query_t* write_query = ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 2, .components = written });
+        ecs_query_iterate_writes(write_query, write_nothing, 1u << 1);
+        changed_visited_count = 0;
+        ecs_query_iterate(changed_query, count_changed);
+        TEST_EXPECT(changed_visited_count == total_count, "Chunk size %d: expected every entity to be changed by the write mask, got %d", chunk_size, changed_visited_count);
+
+        ecs_world_shutdown(world);
+    }
+    return true;
+}
+
+static atomic_uint filtered_visited_count;
+
+static void count_filtered(ecs_iterator_t* iterator) {
+    atomic_fetch_add(&filtered_visited_count, iterator->entity_count);
+}
+
+// Counts the entities a query visits through callback, parallel and pull iteration. Returns false if they disagree.
+static b8 test_count_query(ecs_query_t* query, u32* out_count) {
+    atomic_store(&filtered_visited_count, 0);
+    ecs_query_iterate(query, count_filtered);
+    *out_count = atomic_load(&filtered_visited_count);
+
+    atomic_store(&filtered_visited_count, 0);
+    ecs_query_iterate_parallel(query, count_filtered);
+    u32 parallel_count = atomic_load(&filtered_visited_count);
+    TEST_EXPECT(parallel_count == *out_count, "Callback and parallel iteration visited %d and %d entities", *out_count, parallel_count);
+
+    u32 pull_count = 0;
+    ecs_iterator_t iterator;
+    ecs_query_create_iterator(query, &iterator);
+    while (ecs_iterator_next(&iterator)) {
+        pull_count += iterator.entity_count;
+    }
+    TEST_EXPECT(pull_count == *out_count, "Callback and pull iteration visited %d and %d entities", *out_count, pull_count);
+    return true;
+}
+
+b8 sparse_storage_test() {
+    for (u32 c = 0; c < TEST_CHUNK_SIZE_COUNT; c++) {
+        const u32 chunk_size = test_chunk_sizes[c];
+        ecs_world_t* world = test_world_create();
+        ecs_world_set_chunk_size(world, chunk_size);
+        ECS_COMPONENT_DEFINE_SPARSE(world, stunned_t);
+        const u32 entity_count = 2000;
+        entity_t entities[entity_count];
+        for (u32 i = 0; i < entity_count; i++) {
+            entities[i] = entity_create(world);
+            if (i % 2 == 0) {
+                ENTITY_SET_COMPONENT(world, entities[i], position_t, { .x = i });
+            }
+        }
+
+        // Sparse components never move an entity between archetypes
+        u32 stunned_count = 0;
+        u32 stunned_with_position_count = 0;
+        for (u32 i = 0; i < entity_count; i++) {
+            if (i % 3 != 0) {
+                continue;
+            }
+            entity_record_t record = world->records.data[ENTITY_INDEX(entities[i])];
+            ENTITY_SET_COMPONENT(world, entities[i], stunned_t, { .frames = i });
+            TEST_EXPECT(world->records.data[ENTITY_INDEX(entities[i])].archetype_index == record.archetype_index, "Chunk size %d: adding a sparse component moved entity %d.", chunk_size, i);
+            stunned_count++;
+            stunned_with_position_count += i % 2 == 0;
+        }
+
+        // Destroyed entities leave their sparse sets
+        entity_destroy(world, entities[0]);
+        stunned_count--;
+        stunned_with_position_count--;
+        ENTITY_REMOVE_COMPONENT(world, entities[3], stunned_t);
+        stunned_count--;
+        for (u32 i = 1; i < entity_count; i++) {
+            if (i % 3 == 0 && i != 3) {
+                TEST_EXPECT((ENTITY_GET_COMPONENT(world, entities[i], stunned_t))->frames == i, "Chunk size %d: entity %d lost its sparse component value.", chunk_size, i);
+            } else {
+                TEST_EXPECT(!ENTITY_HAS_COMPONENT(world, entities[i], stunned_t), "Chunk size %d: entity %d has a sparse component it was never given.", chunk_size, i);
+            }
+        }
+
+        ecs_component_id position[] = { ECS_COMPONENT_ID(position_t) };
+        ecs_component_id stunned[] = { ECS_COMPONENT_ID(stunned_t) };
+        ecs_component_id position_stunned[] = { ECS_COMPONENT_ID(position_t), ECS_COMPONENT_ID(stunned_t) };
+        u32 count;
+
+        // Queries of only sparse components visit the entities of the set
+        ecs_query_t* stunned_query = ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 1, .components = stunned });
+        if (!test_count_query(stunned_query, &count)) {
+            return false;
+        }
+        TEST_EXPECT(count == stunned_count, "Chunk size %d: sparse-only query expected %d entities, got %d", chunk_size, stunned_count, count);
+
+        ecs_query_t* stunned_without_position_query = ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 1, .components = stunned, .without_component_count = 1, .without_components = position });
+        if (!test_count_query(stunned_without_position_query, &count)) {
+            return false;
+        }
+        TEST_EXPECT(count == stunned_count - stunned_with_position_count, "Chunk size %d: sparse query without position_t expected %d entities, got %d", chunk_size, stunned_count - stunned_with_position_count, count);
+
+        // Mixed queries filter the archetype's rows by set membership
+        ecs_query_t* position_stunned_query = ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 2, .components = position_stunned });
+        if (!test_count_query(position_stunned_query, &count)) {
+            return false;
+        }
+        TEST_EXPECT(count == stunned_with_position_count, "Chunk size %d: mixed query expected %d entities, got %d", chunk_size, stunned_with_position_count, count);
+
+        ecs_query_t* position_without_stunned_query = ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 1, .components = position, .without_component_count = 1, .without_components = stunned });
+        if (!test_count_query(position_without_stunned_query, &count)) {
+            return false;
+        }
+        u32 position_count = entity_count / 2 - 1;
+        TEST_EXPECT(count == position_count - stunned_with_position_count, "Chunk size %d: query without stunned_t expected %d entities, got %d", chunk_size, position_count - stunned_with_position_count, count);
+
+        ecs_world_shutdown(world);
+    }
+    return true;
+}
+
+b8 disabled_entities_test() {
+    for (u32 c = 0; c < TEST_CHUNK_SIZE_COUNT; c++) {
+        const u32 chunk_size = test_chunk_sizes[c];
+        ecs_world_t* world = test_world_create();
+        ecs_world_set_chunk_size(world, chunk_size);
+        ECS_COMPONENT_DEFINE_SPARSE(world, stunned_t);
+        const u32 entity_count = 1000;
+        entity_t entities[entity_count];
+        for (u32 i = 0; i < entity_count; i++) {
+            entities[i] = entity_create(world);
+            ENTITY_SET_COMPONENT(world, entities[i], position_t, { .x = i });
+            if (i % 4 == 0) {
+                ENTITY_ADD_COMPONENT(world, entities[i], stunned_t);
+            }
+        }
+
+        // Whole words of the disabled mask, single rows and runs crossing word boundaries
+        u32 enabled_count = entity_count;
+        u32 enabled_stunned_count = entity_count / 4;
+        for (u32 i = 0; i < entity_count; i++) {
+            if ((i >= 64 && i < 128) || i % 10 == 3 || (i >= 500 && i < 570) || i == entity_count - 1) {
+                entity_record_t record = world->records.data[ENTITY_INDEX(entities[i])];
+                entity_disable(world, entities[i]);
+                TEST_EXPECT(world->records.data[ENTITY_INDEX(entities[i])].archetype_index == record.archetype_index, "Chunk size %d: disabling entity %d moved it.", chunk_size, i);
+                TEST_EXPECT(!entity_is_enabled(world, entities[i]), "Chunk size %d: entity %d is still enabled.", chunk_size, i);
+                enabled_count--;
+                enabled_stunned_count -= i % 4 == 0;
+            }
+        }
+
+        ecs_component_id position[] = { ECS_COMPONENT_ID(position_t) };
+        ecs_component_id stunned[] = { ECS_COMPONENT_ID(stunned_t) };
+        ecs_query_t* position_query = ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 1, .components = position });
+        ecs_query_t* stunned_query = ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 1, .components = stunned });
+        u32 count;
+        if (!test_count_query(position_query, &count)) {
+            return false;
+        }
+        TEST_EXPECT(count == enabled_count, "Chunk size %d: expected %d enabled entities, got %d", chunk_size, enabled_count, count);
+        if (!test_count_query(stunned_query, &count)) {
+            return false;
+        }
+        TEST_EXPECT(count == enabled_stunned_count, "Chunk size %d: sparse query expected %d enabled entities, got %d", chunk_size, enabled_stunned_count, count);
+
+        // Destroying a row moves the last row into it, which must carry its disabled bit along
+        entity_destroy(world, entities[0]);
+        enabled_count--;
+        enabled_stunned_count--;
+        TEST_EXPECT(!entity_is_enabled(world, entities[entity_count - 1]), "Chunk size %d: moved entity lost its disabled bit.", chunk_size);
+        for (u32 i = 1; i < entity_count; i++) {
+            if (!entity_is_enabled(world, entities[i])) {
+                entity_enable(world, entities[i]);
+                enabled_count++;
+                enabled_stunned_count += i % 4 == 0;
+                break;
+            }
+        }
+        if (!test_count_query(position_query, &count)) {
+            return false;
+        }
+        TEST_EXPECT(count == enabled_count, "Chunk size %d: expected %d enabled entities after destroying and enabling, got %d", chunk_size, enabled_count, count);
+        if (!test_count_query(stunned_query, &count)) {
+            return false;
+        }
+        TEST_EXPECT(count == enabled_stunned_count, "Chunk size %d: sparse query expected %d enabled entities after destroying and enabling, got %d", chunk_size, enabled_stunned_count, count);
+
+        ecs_world_shutdown(world);
+    }
+    return true;
+}
+
+// ================================
+// Queries
+// ================================
+static u32 query_visited_count;
+
+static void count_visited(ecs_iterator_t* iterator) {
+    query_visited_count += iterator->entity_count;
+}
+
+// Returns the number of entities a query visits
+static u32 test_count_entities(ecs_query_t* query) {
+    query_visited_count = 0;
+    ecs_query_iterate(query, count_visited);
+    return query_visited_count;
+}
+
+#define PARALLEL_ENTITY_COUNT 50000
+static atomic_uint parallel_visits[PARALLEL_ENTITY_COUNT];
+static atomic_uint parallel_range_count;
+static atomic_bool parallel_ranges_valid;
+
+/**
+ * @brief The number of threads that ran a range of the current parallel iteration. Each thread remembers the last iteration it counted itself in.
+ */
+static atomic_uint parallel_thread_count;
+static atomic_uint parallel_iteration;
+static thread_local u32 parallel_thread_iteration;
+
+// Marks every entity of the range as visited, then holds on to the range until a second thread has run one, or a second has passed
+static void visit_parallel_range(ecs_iterator_t* iterator) {
+    position_t* positions = ECS_ITERATOR_GET_COMPONENTS(iterator, 0);
+    for (u32 i = 0; i < iterator->entity_count; i++) {
+        entity_t entity = iterator->entities[i];
+        if (entity != iterator->archetype->entities.data[iterator->row_offset + i] || &positions[i] != ENTITY_GET_COMPONENT(iterator->world, entity, position_t)) {
+            atomic_store(&parallel_ranges_valid, false);
+        }
+        atomic_fetch_add(&parallel_visits[(u32)positions[i].x], 1);
+    }
+    atomic_fetch_add(&parallel_range_count, 1);
+
+    u32 iteration = atomic_load(&parallel_iteration);
+    if (parallel_thread_iteration != iteration) {
+        parallel_thread_iteration = iteration;
+        atomic_fetch_add(&parallel_thread_count, 1);
+    }
+
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        sched_yield();
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while (atomic_load(&parallel_thread_count) < 2 && now.tv_sec - start.tv_sec < 1);
+}
+
+b8 query_parallel_iteration_test() {
+    ecs_world_t* world = test_world_create();
+    ecs_world_set_worker_count(world, TEST_WORKER_COUNT);
+
+    // A large archetype split into several ranges, and a small one that fits in a single range
+    const u32 small_count = 1000;
+    const u32 large_count = PARALLEL_ENTITY_COUNT - small_count;
+    for (u32 i = 0; i < PARALLEL_ENTITY_COUNT; i++) {
+        entity_t entity = entity_create(world);
+        if (i >= large_count) {
+            ENTITY_ADD_COMPONENT(world, entity, health_t);
+        }
+        ENTITY_SET_COMPONENT(world, entity, position_t, { .x = i });
+    }
+
+    ecs_component_id components[] = { ECS_COMPONENT_ID(position_t) };
+    ecs_query_t* query = ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 1, .components = components });
+    for (u32 i = 0; i < PARALLEL_ENTITY_COUNT; i++) {
+        atomic_store(&parallel_visits[i], 0);
+    }
+    atomic_store(&parallel_range_count, 0);
+    atomic_store(&parallel_ranges_valid, true);
+    atomic_store(&parallel_thread_count, 0);
+    atomic_fetch_add(&parallel_iteration, 1);
+    ecs_query_iterate_parallel(query, visit_parallel_range);
+
+    const u32 range_rows = smax(ECS_QUERY_PARALLEL_RANGE_SIZE / sizeof(position_t), ECS_QUERY_PARALLEL_MIN_RANGE_ROWS);
+    const u32 expected_range_count = (large_count + range_rows - 1) / range_rows + 1;
+    TEST_EXPECT(expected_range_count > 2, "The large archetype fits in a single range of %d rows.", range_rows);
+    TEST_EXPECT(atomic_load(&parallel_range_count) == expected_range_count, "Expected %d ranges, got %d", expected_range_count, atomic_load(&parallel_range_count));
+    TEST_EXPECT(atomic_load(&parallel_ranges_valid), "A range's entities or components did not start at its row offset.");
+    for (u32 i = 0; i < PARALLEL_ENTITY_COUNT; i++) {
+        TEST_EXPECT(atomic_load(&parallel_visits[i]) == 1, "Entity %d was visited %d times", i, atomic_load(&parallel_visits[i]));
+    }
+    TEST_EXPECT(atomic_load(&parallel_thread_count) > 1, "Every range ran on the same thread.");
+
+    ecs_world_shutdown(world);
+    return true;
+}
+
+b8 query_signature_matching_test() {
+    ecs_world_t* world = test_world_create();
+
+    // Fill the first word of the signatures, so the components defined last are matched in the second
+    while (world->components.count < 64) {
+        ECS_COMPONENT_DEFINE(world, game_time_t);
+    }
+    ECS_COMPONENT_DEFINE(world, odd_t);
+    ECS_COMPONENT_DEFINE(world, wide_t);
+    TEST_EXPECT(ECS_COMPONENT_ID(odd_t) >= 64, "Expected a component past the first signature word, got id %d", ECS_COMPONENT_ID(odd_t));
+
+    ecs_component_id layouts[][2] = {
+        { ECS_COMPONENT_ID(position_t), INVALID_ID },
+        { ECS_COMPONENT_ID(position_t), ECS_COMPONENT_ID(test_velocity_t) },
+        { ECS_COMPONENT_ID(position_t), ECS_COMPONENT_ID(health_t) },
+        { ECS_COMPONENT_ID(position_t), ECS_COMPONENT_ID(odd_t) },
+        { ECS_COMPONENT_ID(position_t), ECS_COMPONENT_ID(wide_t) },
+        { ECS_COMPONENT_ID(test_velocity_t), ECS_COMPONENT_ID(odd_t) },
+    };
+    for (u32 i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++) {
+        entity_t entity = entity_create(world);
+        for (u32 c = 0; c < 2 && layouts[i][c] != INVALID_ID; c++) {
+            entity_add_component(world, entity, layouts[i][c]);
+        }
+    }
+
+    // Excluded components rule out archetypes through either signature word
+    ecs_component_id position[] = { ECS_COMPONENT_ID(position_t) };
+    ecs_component_id health_wide[] = { ECS_COMPONENT_ID(health_t), ECS_COMPONENT_ID(wide_t) };
+    ecs_query_t* position_query = ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 1, .components = position, .without_component_count = 2, .without_components = health_wide });
+    TEST_EXPECT(position_query->archetype_indices.count == 3, "Expected 3 archetypes with position_t and without health_t or wide_t, got %d", position_query->archetype_indices.count);
+    TEST_EXPECT(test_count_entities(position_query) == 3, "Expected 3 entities with position_t and without health_t or wide_t, got %d", query_visited_count);
+
+    ecs_component_id odd[] = { ECS_COMPONENT_ID(odd_t) };
+    ecs_component_id velocity[] = { ECS_COMPONENT_ID(test_velocity_t) };
+    ecs_query_t* odd_query = ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 1, .components = odd, .without_component_count = 1, .without_components = velocity });
+    TEST_EXPECT(odd_query->archetype_indices.count == 1, "Expected 1 archetype with odd_t and without test_velocity_t, got %d", odd_query->archetype_indices.count);
+    for (u32 i = 0; i < world->archetypes.count; i++) {
+        entity_archetype_t* archetype = &world->archetypes.data[i];
+        b8 expected = ecs_component_set_contains(&archetype->component_set, ECS_COMPONENT_ID(odd_t)) && !ecs_component_set_contains(&archetype->component_set, ECS_COMPONENT_ID(test_velocity_t));
+        TEST_EXPECT(ecs_query_matches_archetype(odd_query, archetype) == expected, "Archetype %d %s the query.", i, expected ? "does not match" : "wrongly matches");
+    }
+
+    ecs_world_shutdown(world);
+    return true;
+}
+
+b8 query_deduplication_test() {
+    // The hash only depends on component ids, which every world defining the same components gets, so terms can be hashed without creating their query in the tested world
+    ecs_world_t* scratch_world = test_world_create();
+    ecs_component_id position_velocity[] = { ECS_COMPONENT_ID(position_t), ECS_COMPONENT_ID(test_velocity_t) };
+    ecs_component_id velocity_position[] = { ECS_COMPONENT_ID(test_velocity_t), ECS_COMPONENT_ID(position_t) };
+    ecs_component_id health_armor[] = { ECS_COMPONENT_ID(health_t), ECS_COMPONENT_ID(armor_t) };
+    ecs_component_id armor_health[] = { ECS_COMPONENT_ID(armor_t), ECS_COMPONENT_ID(health_t) };
+    const u64 colliding_hash = ecs_query_create(scratch_world, &(ecs_query_create_info_t) { .component_count = 2, .components = health_armor })->hash;
+    ecs_world_shutdown(scratch_world);
+
+    ecs_world_t* world = test_world_create();
+
+    // Identical terms share a query. Component order decides the order of component_data, but excluded components are a set.
+    ecs_query_t* query = ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 2, .components = position_velocity });
+    TEST_EXPECT(ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 2, .components = position_velocity }) == query, "Identical terms created a new query.");
+    TEST_EXPECT(ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 2, .components = velocity_position }) != query, "Terms in a different order share a query.");
+    TEST_EXPECT(ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 1, .components = position_velocity }) != query, "A subset of the terms shares a query.");
+
+    ecs_query_t* without_query = ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 1, .components = position_velocity, .without_component_count = 2, .without_components = health_armor });
+    TEST_EXPECT(ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 1, .components = position_velocity, .without_component_count = 2, .without_components = armor_health }) == without_query, "Excluded components in a different order created a new query.");
+    TEST_EXPECT(ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 1, .components = position_velocity, .without_component_count = 1, .without_components = health_armor }) != without_query, "Different excluded components share a query.");
+
+    // File an existing query under the hash of terms that have no query yet. Creating their query must look past it and chain the new query in front.
+    ecs_query_map_insert(&world->query_map, colliding_hash, query);
+    ecs_query_t* colliding = ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 2, .components = health_armor });
+    TEST_EXPECT(colliding != query, "Colliding terms returned the query with other terms.");
+    TEST_EXPECT(colliding->hash == colliding_hash, "Expected the colliding query to have hash 0x%lx, got 0x%lx", colliding_hash, colliding->hash);
+    TEST_EXPECT(colliding->next_with_hash == query, "Colliding query was not chained in front of the existing one.");
+    TEST_EXPECT(*ecs_query_map_get(&world->query_map, colliding_hash) == colliding, "Colliding query is not the first of its hash.");
+
+    // Lookups follow the chain past queries with other terms
+    *ecs_query_map_get(&world->query_map, colliding_hash) = query;
+    query->next_with_hash = colliding;
+    colliding->next_with_hash = NULL;
+    TEST_EXPECT(ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 2, .components = health_armor }) == colliding, "Lookup did not follow next_with_hash past a query with other terms.");
+    TEST_EXPECT(ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 2, .components = position_velocity }) == query, "Query is no longer found under its own hash.");
+
+    ecs_world_shutdown(world);
+    return true;
+}
+
+b8 query_iterator_test() {
+    ecs_world_t* world = test_world_create();
+    ecs_world_set_chunk_size(world, 1024);
+
+    // Three archetypes the query matches, each spread over several chunks, and one it does not match
+    const u32 entity_count = 3000;
+    for (u32 i = 0; i < entity_count; i++) {
+        entity_t entity = entity_create(world);
+        ENTITY_SET_COMPONENT(world, entity, position_t, { .x = i });
+        ENTITY_SET_COMPONENT(world, entity, test_velocity_t, { .x = i * 2 });
+        if (i % 3 == 1) {
+            ENTITY_ADD_COMPONENT(world, entity, health_t);
+        } else if (i % 3 == 2) {
+            ENTITY_ADD_COMPONENT(world, entity, armor_t);
+        }
+    }
+    for (u32 i = 0; i < 100; i++) {
+        entity_t entity = entity_create(world);
+        ENTITY_SET_COMPONENT(world, entity, position_t, { .x = entity_count + i });
+    }
+
+    // The query lists its components in a different order than the archetypes store them
+    ecs_component_id components[] = { ECS_COMPONENT_ID(test_velocity_t), ECS_COMPONENT_ID(position_t) };
+    ecs_query_t* query = ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 2, .components = components });
+    u8 visits[entity_count];
+    memset(visits, 0, sizeof(visits));
+    u32 range_count = 0;
+    u32 archetype_ids[3];
+    u32 archetype_count = 0;
+
+    ecs_iterator_t iterator;
+    ecs_query_create_iterator(query, &iterator);
+    while (ecs_iterator_next(&iterator)) {
+        range_count++;
+        TEST_EXPECT(iterator.entity_count > 0 && iterator.entity_count <= iterator.archetype->chunk_row_count, "Range of %d entities does not fit in a chunk of %d rows", iterator.entity_count, iterator.archetype->chunk_row_count);
+        if (archetype_count == 0 || archetype_ids[archetype_count - 1] != iterator.archetype->archetype_id) {
+            TEST_EXPECT(archetype_count < 3, "Iterator visited more than the 3 matching archetypes, or came back to one.");
+            archetype_ids[archetype_count++] = iterator.archetype->archetype_id;
+        }
+
+        test_velocity_t* velocities = iterator.component_data[0];
+        position_t* positions = iterator.component_data[1];
+        for (u32 i = 0; i < iterator.entity_count; i++) {
+            entity_t entity = iterator.entities[i];
+            TEST_EXPECT(entity == iterator.archetype->entities.data[iterator.row_offset + i], "Range entity %d is not at its row offset.", i);
+            TEST_EXPECT(&positions[i] == ENTITY_GET_COMPONENT(world, entity, position_t), "Range position %d is not the entity's.", i);
+            TEST_EXPECT(&velocities[i] == ENTITY_GET_COMPONENT(world, entity, test_velocity_t), "Range velocity %d is not the entity's.", i);
+            visits[(u32)positions[i].x]++;
+        }
+    }
+    TEST_EXPECT(iterator.entity_count == 0, "Finished iterator still has %d entities", iterator.entity_count);
+    TEST_EXPECT(archetype_count == 3, "Expected 3 archetypes, visited %d", archetype_count);
+    TEST_EXPECT(range_count > archetype_count, "Expected the archetypes to span several chunks, got %d ranges", range_count);
+    for (u32 i = 0; i < entity_count; i++) {
+        TEST_EXPECT(visits[i] == 1, "Entity %d was visited %d times", i, visits[i]);
+    }
+
+    ecs_world_shutdown(world);
+    return true;
+}
+
+static b8 term_ranges_valid;
+
+// Checks that a (health_t, position_t) query's arrays hold each entity's components
+static void check_term_range(ecs_iterator_t* iterator) {
+    health_t* healths = ECS_ITERATOR_GET_COMPONENTS(iterator, 0);
+    position_t* positions = ECS_ITERATOR_GET_COMPONENTS(iterator, 1);
+    for (u32 i = 0; i < iterator->entity_count; i++) {
+        term_ranges_valid &= &healths[i] == ENTITY_GET_COMPONENT(iterator->world, iterator->entities[i], health_t);
+        term_ranges_valid &= &positions[i] == ENTITY_GET_COMPONENT(iterator->world, iterator->entities[i], position_t);
+        term_ranges_valid &= healths[i].value == positions[i].x * 2;
+    }
+}
+
+// Checks a query's cached term columns against every archetype it matches
+static b8 test_term_columns_valid(ecs_query_t* query) {
+    for (u32 m = 0; m < query->archetype_indices.count; m++) {
+        entity_archetype_t* archetype = &query->world->archetypes.data[query->archetype_indices.data[m]];
+        for (u32 t = 0; t < query->components.count; t++) {
+            u32 expected = ecs_component_set_get_index(&archetype->component_set, query->components.data[t]);
+            u32 cached = query->term_columns.data[m * query->components.count + t];
+            TEST_EXPECT(cached == expected, "Term %d of archetype %d is cached as column %d, expected %d", t, archetype->archetype_id, cached, expected);
+        }
+    }
+    return true;
+}
+
+b8 query_term_columns_test() {
+    ecs_world_t* world = test_world_create();
+    ECS_COMPONENT_DEFINE(world, odd_t);
+
+    // Created before any archetype, so every match is cached as its archetype appears
+    ecs_component_id components[] = { ECS_COMPONENT_ID(health_t), ECS_COMPONENT_ID(position_t) };
+    ecs_query_t* query = ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 2, .components = components });
+
+    // Each layout places the terms in different columns
+    ecs_component_id layouts[][2] = {
+        { INVALID_ID, INVALID_ID },
+        { ECS_COMPONENT_ID(test_velocity_t), INVALID_ID },
+        { ECS_COMPONENT_ID(armor_t), INVALID_ID },
+        { ECS_COMPONENT_ID(test_velocity_t), ECS_COMPONENT_ID(armor_t) },
+        { ECS_COMPONENT_ID(odd_t), ECS_COMPONENT_ID(test_velocity_t) },
+    };
+    const u32 layout_count = sizeof(layouts) / sizeof(layouts[0]);
+    for (u32 l = 0; l < layout_count; l++) {
+        for (u32 i = 0; i < 10; i++) {
+            entity_t entity = entity_create(world);
+            for (u32 c = 0; c < 2 && layouts[l][c] != INVALID_ID; c++) {
+                entity_add_component(world, entity, layouts[l][c]);
+            }
+            ENTITY_SET_COMPONENT(world, entity, position_t, { .x = l * 10 + i });
+            ENTITY_SET_COMPONENT(world, entity, health_t, { .value = (l * 10 + i) * 2 });
+        }
+
+        // Iterating between archetypes being created must not leave stale columns behind
+        term_ranges_valid = true;
+        ecs_query_iterate(query, check_term_range);
+        TEST_EXPECT(term_ranges_valid, "Query arrays did not match the entities after %d layouts", l + 1);
+        TEST_EXPECT(test_count_entities(query) == (l + 1) * 10, "Expected %d entities, got %d", (l + 1) * 10, query_visited_count);
+    }
+    if (!test_term_columns_valid(query)) {
+        return false;
+    }
+
+    ecs_world_shutdown(world);
+    return true;
+}
+
+b8 query_non_empty_matches_test() {
+    ecs_world_t* world = test_world_create();
+    ecs_component_id components[] = { ECS_COMPONENT_ID(position_t) };
+    ecs_query_t* query = ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 1, .components = components });
+
+    const u32 entity_count = 100;
+    entity_t positioned[entity_count];
+    entity_t moving[entity_count];
+    for (u32 i = 0; i < entity_count; i++) {
+        positioned[i] = entity_create(world);
+        ENTITY_ADD_COMPONENT(world, positioned[i], position_t);
+        moving[i] = entity_create(world);
+        ENTITY_ADD_COMPONENT(world, moving[i], position_t);
+        ENTITY_ADD_COMPONENT(world, moving[i], test_velocity_t);
+    }
+    TEST_EXPECT(query->archetype_indices.count == 2 && query->non_empty_matches.count == 2, "Expected 2 non-empty archetypes of 2, got %d of %d", query->non_empty_matches.count, query->archetype_indices.count);
+
+    // Archetypes leave the list when their last entity does, but stay matched
+    for (u32 i = 0; i < entity_count; i++) {
+        entity_destroy(world, positioned[i]);
+    }
+    TEST_EXPECT(query->archetype_indices.count == 2 && query->non_empty_matches.count == 1, "Expected 1 non-empty archetype of 2, got %d of %d", query->non_empty_matches.count, query->archetype_indices.count);
+    TEST_EXPECT(test_count_entities(query) == entity_count, "Expected %d entities, got %d", entity_count, query_visited_count);
+    for (u32 i = 0; i < entity_count; i++) {
+        entity_destroy(world, moving[i]);
+    }
+    TEST_EXPECT(query->non_empty_matches.count == 0, "Expected no non-empty archetypes, got %d", query->non_empty_matches.count);
+    TEST_EXPECT(test_count_entities(query) == 0, "Expected no entities, got %d", query_visited_count);
+
+    // And rejoin it when entities are spawned or moved into them again
+    for (u32 i = 0; i < 10; i++) {
+        positioned[i] = entity_create(world);
+        ENTITY_ADD_COMPONENT(world, positioned[i], position_t);
+    }
+    TEST_EXPECT(query->non_empty_matches.count == 1, "Expected 1 non-empty archetype after respawning, got %d", query->non_empty_matches.count);
+    TEST_EXPECT(test_count_entities(query) == 10, "Expected 10 entities after respawning, got %d", query_visited_count);
+    ENTITY_ADD_COMPONENT(world, positioned[0], test_velocity_t);
+    TEST_EXPECT(query->non_empty_matches.count == 2, "Expected 2 non-empty archetypes after moving an entity, got %d", query->non_empty_matches.count);
+    ENTITY_REMOVE_COMPONENT(world, positioned[0], test_velocity_t);
+    TEST_EXPECT(query->non_empty_matches.count == 1, "Expected 1 non-empty archetype after moving the entity back, got %d", query->non_empty_matches.count);
+    TEST_EXPECT(test_count_entities(query) == 10, "Expected 10 entities after moving one back, got %d", query_visited_count);
+    TEST_EXPECT(query->archetype_indices.count == 2, "Expected the query to still match 2 archetypes, got %d", query->archetype_indices.count);
+
+    ecs_world_shutdown(world);
+    return true;
+}
+
+// Checks that two queries match the same archetypes
+static b8 test_queries_match_same(ecs_query_t* a, ecs_query_t* b) {
+    TEST_EXPECT(a->archetype_indices.count == b->archetype_indices.count, "Queries match %d and %d archetypes", a->archetype_indices.count, b->archetype_indices.count);
+    for (u32 i = 0; i < a->archetype_indices.count; i++) {
+        b8 found = false;
+        for (u32 j = 0; j < b->archetype_indices.count; j++) {
+            found |= a->archetype_indices.data[i] == b->archetype_indices.data[j];
+        }
+        TEST_EXPECT(found, "Archetype %d is only matched by one query.", a->archetype_indices.data[i]);
+    }
+    return true;
+}
+
+b8 query_matching_order_test() {
+    ecs_world_t* world = test_world_create();
+    ECS_COMPONENT_DEFINE(world, odd_t);
+    ecs_component_id position_health[] = { ECS_COMPONENT_ID(position_t), ECS_COMPONENT_ID(health_t) };
+    ecs_component_id health_position[] = { ECS_COMPONENT_ID(health_t), ECS_COMPONENT_ID(position_t) };
+    ecs_component_id armor[] = { ECS_COMPONENT_ID(armor_t) };
+
+    // The first query matches archetypes as they are created, the second finds them through its component's archetype list
+    ecs_query_t* before = ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 2, .components = position_health, .without_component_count = 1, .without_components = armor });
+    ecs_component_id layouts[][3] = {
+        { ECS_COMPONENT_ID(position_t), INVALID_ID, INVALID_ID },
+        { ECS_COMPONENT_ID(position_t), ECS_COMPONENT_ID(health_t), INVALID_ID },
+        { ECS_COMPONENT_ID(position_t), ECS_COMPONENT_ID(health_t), ECS_COMPONENT_ID(test_velocity_t) },
+        { ECS_COMPONENT_ID(position_t), ECS_COMPONENT_ID(health_t), ECS_COMPONENT_ID(armor_t) },
+        { ECS_COMPONENT_ID(health_t), ECS_COMPONENT_ID(test_velocity_t), INVALID_ID },
+    };
+    for (u32 i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++) {
+        entity_t entity = entity_create(world);
+        for (u32 c = 0; c < 3 && layouts[i][c] != INVALID_ID; c++) {
+            entity_add_component(world, entity, layouts[i][c]);
+        }
+    }
+    ecs_query_t* after = ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 2, .components = health_position, .without_component_count = 1, .without_components = armor });
+    TEST_EXPECT(before != after, "Queries with terms in a different order were shared.");
+    TEST_EXPECT(before->archetype_indices.count == 2, "Query created before its archetypes matched %d, expected 2", before->archetype_indices.count);
+    if (!test_queries_match_same(before, after)) {
+        return false;
+    }
+    TEST_EXPECT(test_count_entities(before) == 2 && test_count_entities(after) == 2, "Expected both queries to visit 2 entities");
+
+    // Archetypes created after both queries are matched by both
+    entity_t entity = entity_create(world);
+    ENTITY_ADD_COMPONENT(world, entity, odd_t);
+    ENTITY_ADD_COMPONENT(world, entity, health_t);
+    ENTITY_ADD_COMPONENT(world, entity, position_t);
+    TEST_EXPECT(before->archetype_indices.count == 3, "Query did not match a new archetype, matches %d", before->archetype_indices.count);
+    if (!test_queries_match_same(before, after)) {
+        return false;
+    }
+    TEST_EXPECT(test_count_entities(before) == 3 && test_count_entities(after) == 3, "Expected both queries to visit 3 entities");
+
+    ecs_world_shutdown(world);
+    return true;
+}
+
+// Checks if a query is indexed under a component
+static b8 test_query_indexed_under(ecs_world_t* world, ecs_query_t* query, ecs_component_id component) {
+    darray_ecs_query_ptr_t* queries = &world->components.data[component].queries;
+    for (u32 i = 0; i < queries->count; i++) {
+        if (queries->data[i] == query) {
+            return true;
+        }
+    }
+    return false;
+}
+
+b8 query_rarest_component_test() {
+    ecs_world_t* world = test_world_create();
+    ecs_component_id layouts[][3] = {
+        { ECS_COMPONENT_ID(position_t), INVALID_ID, INVALID_ID },
+        { ECS_COMPONENT_ID(position_t), ECS_COMPONENT_ID(test_velocity_t), INVALID_ID },
+        { ECS_COMPONENT_ID(position_t), ECS_COMPONENT_ID(health_t), INVALID_ID },
+        { ECS_COMPONENT_ID(position_t), ECS_COMPONENT_ID(test_velocity_t), ECS_COMPONENT_ID(health_t) },
+        { ECS_COMPONENT_ID(position_t), ECS_COMPONENT_ID(armor_t), INVALID_ID },
+    };
+    for (u32 i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++) {
+        entity_t entity = entity_create(world);
+        for (u32 c = 0; c < 3 && layouts[i][c] != INVALID_ID; c++) {
+            entity_add_component(world, entity, layouts[i][c]);
+        }
+    }
+
+    // Queries are indexed under whichever of their components is in the fewest archetypes, wherever it is in their terms
+    ecs_component_id position_armor[] = { ECS_COMPONENT_ID(position_t), ECS_COMPONENT_ID(armor_t) };
+    ecs_component_id velocity_position[] = { ECS_COMPONENT_ID(test_velocity_t), ECS_COMPONENT_ID(position_t) };
+    ecs_query_t* armor_query = ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 2, .components = position_armor });
+    ecs_query_t* velocity_query = ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 2, .components = velocity_position });
+    TEST_EXPECT(test_query_indexed_under(world, armor_query, ECS_COMPONENT_ID(armor_t)), "Query was not indexed under its rarest component.");
+    TEST_EXPECT(!test_query_indexed_under(world, armor_query, ECS_COMPONENT_ID(position_t)), "Query was indexed under a common component.");
+    TEST_EXPECT(test_query_indexed_under(world, velocity_query, ECS_COMPONENT_ID(test_velocity_t)), "Query was not indexed under its rarest component.");
+    TEST_EXPECT(!test_query_indexed_under(world, velocity_query, ECS_COMPONENT_ID(position_t)), "Query was indexed under a common component.");
+    TEST_EXPECT(armor_query->archetype_indices.count == 1 && velocity_query->archetype_indices.count == 2, "Queries matched %d and %d archetypes, expected 1 and 2", armor_query->archetype_indices.count, velocity_query->archetype_indices.count);
+
+    // New archetypes with the indexed component still reach the queries
+    entity_t entity = entity_create(world);
+    ENTITY_ADD_COMPONENT(world, entity, armor_t);
+    ENTITY_ADD_COMPONENT(world, entity, test_velocity_t);
+    ENTITY_ADD_COMPONENT(world, entity, position_t);
+    TEST_EXPECT(armor_query->archetype_indices.count == 2 && velocity_query->archetype_indices.count == 3, "Queries matched %d and %d archetypes, expected 2 and 3", armor_query->archetype_indices.count, velocity_query->archetype_indices.count);
+    TEST_EXPECT(test_count_entities(armor_query) == 2, "Expected 2 entities with armor_t, got %d", query_visited_count);
+
+    ecs_world_shutdown(world);
+    return true;
+}
+
+b8 query_each_test() {
+    ecs_world_t* world = test_world_create();
+    ecs_world_set_chunk_size(world, 64);
+    const u32 entity_count = 200;
+    entity_t entities[entity_count];
+    for (u32 i = 0; i < entity_count; i++) {
+        entities[i] = entity_create(world);
+        ENTITY_SET_COMPONENT(world, entities[i], position_t, { .x = i });
+        ENTITY_SET_COMPONENT(world, entities[i], test_velocity_t, { .x = i * 2 });
+        if (i % 4 == 0) {
+            ENTITY_ADD_COMPONENT(world, entities[i], health_t);
+        }
+    }
+
+    // Each name points at the entity's own component, across archetypes and chunks
+    ecs_component_id components[] = { ECS_COMPONENT_ID(position_t), ECS_COMPONENT_ID(test_velocity_t) };
+    ecs_query_t* query = ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 2, .components = components });
+    u32 visited_count = 0;
+    b8 pointers_valid = true;
+    ECS_QUERY_EACH(query, (position_t, position), (test_velocity_t, velocity)) {
+        pointers_valid &= position == ENTITY_GET_COMPONENT(world, ECS_QUERY_EACH_ENTITY, position_t);
+        pointers_valid &= velocity == ENTITY_GET_COMPONENT(world, ECS_QUERY_EACH_ENTITY, test_velocity_t);
+        velocity->y = position->x + velocity->x;
+        visited_count++;
+    }
+    TEST_EXPECT(pointers_valid, "A component pointer did not belong to its entity.");
+    TEST_EXPECT(visited_count == entity_count, "Expected %d entities, visited %d", entity_count, visited_count);
+    for (u32 i = 0; i < entity_count; i++) {
+        TEST_EXPECT((ENTITY_GET_COMPONENT(world, entities[i], test_velocity_t))->y == i * 3, "Entity %d was not written through its pointer.", i);
+    }
+
+    // continue only skips the rest of the block for one entity
+    visited_count = 0;
+    u32 odd_count = 0;
+    ECS_QUERY_EACH(query, (position_t, position)) {
+        visited_count++;
+        if ((u32)position->x % 2 == 0) {
+            continue;
+        }
+        odd_count++;
+    }
+    TEST_EXPECT(visited_count == entity_count && odd_count == entity_count / 2, "Expected %d entities and %d odd ones, got %d and %d", entity_count, entity_count / 2, visited_count, odd_count);
+
+    ecs_world_shutdown(world);
+    return true;
+}
+
+b8 query_each_break_test() {
+    ecs_world_t* world = test_world_create();
+    ecs_world_set_chunk_size(world, 64);
+    const u32 entity_count = 200;
+    for (u32 i = 0; i < entity_count; i++) {
+        entity_t entity = entity_create(world);
+        ENTITY_SET_COMPONENT(world, entity, position_t, { .x = i });
+        ENTITY_ADD_COMPONENT(world, entity, test_velocity_t);
+    }
+
+    // break leaves every range, not only the current one
+    ecs_component_id components[] = { ECS_COMPONENT_ID(position_t), ECS_COMPONENT_ID(test_velocity_t) };
+    ecs_query_t* query = ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 2, .components = components });
+    const u32 stop_count = entity_count / 2;
+    u32 visited_count = 0;
+    ECS_QUERY_EACH(query, (position_t, position), (test_velocity_t, velocity)) {
+        if (visited_count == stop_count) {
+            break;
+        }
+        velocity->x = position->x;
+        visited_count++;
+    }
+    TEST_EXPECT(visited_count == stop_count, "Expected the loop to stop after %d entities, visited %d", stop_count, visited_count);
+
+    // A loop after a break starts from the beginning
+    visited_count = 0;
+    ECS_QUERY_EACH(query, (position_t, position)) {
+        (void)position;
+        visited_count++;
+    }
+    TEST_EXPECT(visited_count == entity_count, "Expected %d entities after a break, visited %d", entity_count, visited_count);
+
+    ecs_world_shutdown(world);
+    return true;
+}
+
+// ================================
+// Systems
+// ================================
+static void move_system(ecs_iterator_t* iterator) {
+    position_t* positions = ECS_ITERATOR_GET_COMPONENTS(iterator, 0);
+    for (u32 i = 0; i < iterator->entity_count; i++) {
+        positions[i].x += 1;
+    }
+}
+
+static void accelerate_system(ecs_iterator_t* iterator) {
+    test_velocity_t* velocities = ECS_ITERATOR_GET_COMPONENTS(iterator, 0);
+    for (u32 i = 0; i < iterator->entity_count; i++) {
+        velocities[i].x += 1;
+    }
+}
+
+static void heal_system(ecs_iterator_t* iterator) {
+    health_t* healths = ECS_ITERATOR_GET_COMPONENTS(iterator, 0);
+    for (u32 i = 0; i < iterator->entity_count; i++) {
+        healths[i].value += 1;
+    }
+}
+
+static void repair_system(ecs_iterator_t* iterator) {
+    armor_t* armors = ECS_ITERATOR_GET_COMPONENTS(iterator, 0);
+    for (u32 i = 0; i < iterator->entity_count; i++) {
+        armors[i].value += 1;
+    }
+}
+
+b8 parallel_systems_test() {
+    ecs_world_t* world = test_world_create();
+    ecs_world_set_worker_count(world, TEST_WORKER_COUNT);
+    const u32 entity_count = 20000;
+    ecs_component_id components[] = { ECS_COMPONENT_ID(position_t), ECS_COMPONENT_ID(test_velocity_t), ECS_COMPONENT_ID(health_t), ECS_COMPONENT_ID(armor_t) };
+    entity_t entities[entity_count];
+    for (u32 i = 0; i < entity_count; i++) {
+        entities[i] = entity_create(world);
+        for (u32 c = 0; c < 4; c++) {
+            entity_add_component(world, entities[i], components[c]);
+        }
+    }
+
+    // Each system writes its own component, so all four share a batch and run on the job system together
+    void (*callbacks[])(ecs_iterator_t*) = { move_system, accelerate_system, heal_system, repair_system };
+    for (u32 i = 0; i < 4; i++) {
+        ecs_system_create(world, ECS_PHASE_UPDATE, &(ecs_query_create_info_t) { .component_count = 1, .components = &components[i] }, callbacks[i], "parallel_test_system");
+    }
+
+    const u32 frame_count = 10;
+    for (u32 frame = 0; frame < frame_count; frame++) {
+        ecs_world_progress(world);
+    }
+    TEST_EXPECT(world->schedules[ECS_PHASE_UPDATE].batch_offsets.count == 2, "Expected non-conflicting systems to share one batch, got %d batches", world->schedules[ECS_PHASE_UPDATE].batch_offsets.count - 1);
+
+    // Every component starts with a float at offset zero
+    for (u32 i = 0; i < entity_count; i++) {
+        for (u32 c = 0; c < 4; c++) {
+            f32 value = *(f32*)entity_get_component(world, entities[i], components[c]);
+            TEST_EXPECT(value == frame_count, "Component %d of entity %d is %f after %d frames", c, i, value, frame_count);
+        }
+    }
+
+    ecs_world_shutdown(world);
+    return true;
+}
+
+static void idle_system(ecs_iterator_t* iterator) {
+    (void)iterator;
+}
+
+// Copies each entity's position into its health. Declared as reading position_t and writing health_t.
+static void copy_position_system(ecs_iterator_t* iterator) {
+    position_t* positions = ECS_ITERATOR_GET_COMPONENTS(iterator, 0);
+    health_t* healths = ECS_ITERATOR_GET_COMPONENTS(iterator, 1);
+    for (u32 i = 0; i < iterator->entity_count; i++) {
+        healths[i].value = positions[i].x;
+    }
+}
+
+// Returns the batch a phase's system_index'th system was scheduled in
+static u32 test_get_system_batch(const ecs_schedule_t* schedule, u32 system_index) {
+    for (u32 batch = 0; batch + 1 < schedule->batch_offsets.count; batch++) {
+        for (u32 i = schedule->batch_offsets.data[batch]; i < schedule->batch_offsets.data[batch + 1]; i++) {
+            if (schedule->system_indices.data[i] == system_index) {
+                return batch;
+            }
+        }
+    }
+    return INVALID_ID;
+}
+
+b8 system_scheduling_test() {
+    ecs_world_t* world = test_world_create();
+    ecs_world_set_worker_count(world, TEST_WORKER_COUNT);
+    const u32 entity_count = 5000;
+    entity_t entities[entity_count];
+    for (u32 i = 0; i < entity_count; i++) {
+        entities[i] = entity_create(world);
+        ENTITY_ADD_COMPONENT(world, entities[i], position_t);
+        ENTITY_ADD_COMPONENT(world, entities[i], test_velocity_t);
+        ENTITY_ADD_COMPONENT(world, entities[i], health_t);
+    }
+
+    ecs_component_id position[] = { ECS_COMPONENT_ID(position_t) };
+    ecs_component_id velocity[] = { ECS_COMPONENT_ID(test_velocity_t) };
+    ecs_component_id health[] = { ECS_COMPONENT_ID(health_t) };
+    ecs_component_id position_health[] = { ECS_COMPONENT_ID(position_t), ECS_COMPONENT_ID(health_t) };
+    ecs_access_t read[] = { ECS_ACCESS_READ };
+    ecs_access_t read_write[] = { ECS_ACCESS_READ, ECS_ACCESS_READ_WRITE };
+
+    // Systems are placed one batch after the latest earlier system they conflict with
+    ecs_system_create(world, ECS_PHASE_UPDATE, &(ecs_query_create_info_t) { .component_count = 1, .components = position }, move_system, "write_position");
+    ecs_system_create(world, ECS_PHASE_UPDATE, &(ecs_query_create_info_t) { .component_count = 1, .components = position, .component_access = read }, idle_system, "read_position_a");
+    ecs_system_create(world, ECS_PHASE_UPDATE, &(ecs_query_create_info_t) { .component_count = 1, .components = position, .component_access = read }, idle_system, "read_position_b");
+    ecs_system_create(world, ECS_PHASE_UPDATE, &(ecs_query_create_info_t) { .component_count = 1, .components = velocity }, accelerate_system, "write_velocity");
+    ecs_system_create(world, ECS_PHASE_UPDATE, &(ecs_query_create_info_t) { .component_count = 2, .components = position_health, .component_access = read_write }, copy_position_system, "copy_position");
+    ecs_system_create(world, ECS_PHASE_UPDATE, &(ecs_query_create_info_t) { .component_count = 1, .components = health, .component_access = read }, idle_system, "read_health");
+
+    const u32 frame_count = 3;
+    for (u32 frame = 0; frame < frame_count; frame++) {
+        ecs_world_progress(world);
+    }
+
+    const ecs_schedule_t* schedule = &world->schedules[ECS_PHASE_UPDATE];
+    const u32 expected_batches[] = { 0, 1, 1, 0, 1, 2 };
+    for (u32 i = 0; i < 6; i++) {
+        u32 batch = test_get_system_batch(schedule, i);
+        TEST_EXPECT(batch == expected_batches[i], "System %d expected in batch %d, got %d", i, expected_batches[i], batch);
+    }
+    TEST_EXPECT(world->systems[ECS_PHASE_UPDATE].data[4].write_mask == 1u << 1, "Expected copy_position to only write its second component, got write mask 0x%x", world->systems[ECS_PHASE_UPDATE].data[4].write_mask);
+
+    // The reader ran after the writer every frame
+    for (u32 i = 0; i < entity_count; i++) {
+        f32 value = (ENTITY_GET_COMPONENT(world, entities[i], health_t))->value;
+        TEST_EXPECT(value == frame_count, "Entity %d copied position %f, expected %d", i, value, frame_count);
+    }
+
+    ecs_world_shutdown(world);
+    return true;
+}
+
+static void advance_time_system(ecs_iterator_t* iterator) {
+    // Runs once per range, so only the first range advances the clock
+    if (iterator->row_offset == 0) {
+        ECS_WORLD_GET_RESOURCE(iterator->world, game_time_t)->frame++;
+    }
+}
+
+static void stamp_time_system(ecs_iterator_t* iterator) {
+    armor_t* armors = ECS_ITERATOR_GET_COMPONENTS(iterator, 0);
+    u32 frame = ECS_WORLD_GET_RESOURCE(iterator->world, game_time_t)->frame;
+    for (u32 i = 0; i < iterator->entity_count; i++) {
+        armors[i].value = frame;
+    }
+}
+
+b8 world_resources_test() {
+    ecs_world_t* world = test_world_create();
+    ecs_world_set_worker_count(world, TEST_WORKER_COUNT);
+    ECS_COMPONENT_DEFINE(world, game_time_t);
+
+    // Resources live outside of archetypes and are stable until removed
+    u32 archetype_count = world->archetypes.count;
+    TEST_EXPECT(ECS_WORLD_GET_RESOURCE(world, game_time_t) == NULL, "Resource exists before it was set.");
+    ECS_WORLD_SET_RESOURCE(world, game_time_t, { .frame = 7 });
+    game_time_t* time = ECS_WORLD_GET_RESOURCE(world, game_time_t);
+    TEST_EXPECT(time && time->frame == 7, "Resource was not set.");
+    ECS_WORLD_SET_RESOURCE(world, game_time_t, { .frame = 0 });
+    TEST_EXPECT(ECS_WORLD_GET_RESOURCE(world, game_time_t) == time, "Setting a resource again moved it.");
+    TEST_EXPECT(time->frame == 0, "Resource was not overwritten.");
+    TEST_EXPECT(world->archetypes.count == archetype_count && world->entity_count == 0, "Setting a resource created archetypes or entities.");
+
+    const u32 entity_count = 1000;
+    ecs_component_id components[] = { ECS_COMPONENT_ID(position_t), ECS_COMPONENT_ID(armor_t) };
+    entity_create_bulk(world, entity_count, components, 2, NULL);
+
+    // Resource access is scheduled like component access: readers wait for the writer, and share a batch with each other
+    ecs_component_id position[] = { ECS_COMPONENT_ID(position_t) };
+    ecs_component_id armor[] = { ECS_COMPONENT_ID(armor_t) };
+    ecs_component_id resources[] = { ECS_COMPONENT_ID(game_time_t) };
+    ecs_access_t read[] = { ECS_ACCESS_READ };
+    ecs_system_create(world, ECS_PHASE_UPDATE, &(ecs_query_create_info_t) { .component_count = 1, .components = position, .component_access = read, .resource_count = 1, .resources = resources }, advance_time_system, "advance_time");
+    ecs_system_create(world, ECS_PHASE_UPDATE, &(ecs_query_create_info_t) { .component_count = 1, .components = armor, .resource_count = 1, .resources = resources, .resource_access = read }, stamp_time_system, "stamp_time");
+    ecs_system_create(world, ECS_PHASE_UPDATE, &(ecs_query_create_info_t) { .component_count = 1, .components = position, .component_access = read, .resource_count = 1, .resources = resources, .resource_access = read }, idle_system, "read_time");
+
+    const u32 frame_count = 4;
+    for (u32 frame = 0; frame < frame_count; frame++) {
+        ecs_world_progress(world);
+    }
+
+    const ecs_schedule_t* schedule = &world->schedules[ECS_PHASE_UPDATE];
+    TEST_EXPECT(test_get_system_batch(schedule, 0) == 0, "Resource writer expected in batch 0, got %d", test_get_system_batch(schedule, 0));
+    TEST_EXPECT(test_get_system_batch(schedule, 1) == 1, "Resource reader expected in batch 1, got %d", test_get_system_batch(schedule, 1));
+    TEST_EXPECT(test_get_system_batch(schedule, 2) == 1, "Second resource reader expected in batch 1, got %d", test_get_system_batch(schedule, 2));
+    TEST_EXPECT(time->frame == frame_count, "Expected the clock at frame %d, got %d", frame_count, time->frame);
+
+    entity_archetype_t* archetype = &world->archetypes.data[world->records.data[0].archetype_index];
+    ecs_column_t* armor_column = entity_archetype_get_column(archetype, ECS_COMPONENT_ID(armor_t));
+    for (u32 row = 0; row < archetype->entities.count; row++) {
+        f32 value = ((armor_t*)ecs_component_column_get(armor_column, row))->value;
+        TEST_EXPECT(value == frame_count, "Row %d read frame %f, expected %d", row, value, frame_count);
+    }
+
+    ECS_WORLD_REMOVE_RESOURCE(world, game_time_t);
+    TEST_EXPECT(ECS_WORLD_GET_RESOURCE(world, game_time_t) == NULL, "Removed resource still exists.");
+
+    ecs_world_shutdown(world);
+    return true;
+}
+
+// ================================
+// Static components
+// ================================
+typedef struct static_position {
+    f32 x;
+    f32 y;
+    f32 z;
+} static_position_t;
+
+typedef struct static_stunned {
+    u32 frames;
+} static_stunned_t;
+
+#define TEST_STATIC_COMPONENTS(COMPONENT, SPARSE, TAG) \
+    COMPONENT(static_position_t) \
+    SPARSE(static_stunned_t) \
+    TAG(static_tag)
+ECS_STATIC_COMPONENTS(TEST_STATIC_COMPONENTS)
+
+b8 static_components_test() {
+    // Every world gets the same ids, so registering twice checks they do not depend on earlier worlds
+    for (u32 w = 0; w < 2; w++) {
+        ecs_world_t* world = ecs_world_initialize();
+        ecs_world_register_static_components(world);
+        TEST_EXPECT(world->components.count == ECS_STATIC_COMPONENTS_END, "Expected %d components, got %d", ECS_STATIC_COMPONENTS_END, world->components.count);
+
+        ecs_component_t* position = &world->components.data[ECS_COMPONENT_ID(static_position_t)];
+        ecs_component_t* stunned = &world->components.data[ECS_COMPONENT_ID(static_stunned_t)];
+        ecs_component_t* tag = &world->components.data[ECS_COMPONENT_ID(static_tag)];
+        TEST_EXPECT(position->stride == sizeof(static_position_t) && position->storage == ECS_STORAGE_TABLE, "Static component was registered with stride %d and storage %d", position->stride, position->storage);
+        TEST_EXPECT(stunned->stride == sizeof(static_stunned_t) && stunned->storage == ECS_STORAGE_SPARSE, "Static sparse component was registered with stride %d and storage %d", stunned->stride, stunned->storage);
+        TEST_EXPECT(tag->stride == 0 && tag->storage == ECS_STORAGE_TABLE, "Static tag was registered with stride %d and storage %d", tag->stride, tag->storage);
+
+        // Static ids work with the same macros as declared components
+        entity_t entity = entity_create(world);
+        ENTITY_SET_COMPONENT(world, entity, static_position_t, { .z = 3 });
+        ENTITY_SET_COMPONENT(world, entity, static_stunned_t, { .frames = 2 });
+        ENTITY_ADD_COMPONENT(world, entity, static_tag);
+        TEST_EXPECT((ENTITY_GET_COMPONENT(world, entity, static_position_t))->z == 3, "Static component value was not set.");
+        TEST_EXPECT((ENTITY_GET_COMPONENT(world, entity, static_stunned_t))->frames == 2, "Static sparse component value was not set.");
+        TEST_EXPECT(ENTITY_HAS_COMPONENT(world, entity, static_tag), "Static tag was not added.");
+
+        // Components defined after the registry follow it
+        ECS_COMPONENT_DEFINE(world, position_t);
+        TEST_EXPECT(ECS_COMPONENT_ID(position_t) == ECS_STATIC_COMPONENTS_END, "Expected the first dynamic component id to be %d, got %d", ECS_STATIC_COMPONENTS_END, ECS_COMPONENT_ID(position_t));
+
+        ecs_world_shutdown(world);
+    }
+    return true;
+}
+
+// ================================
+// Command buffers
+// ================================
+b8 command_buffer_coalescing_test() {
+    ecs_world_t* world = test_world_create();
+    ecs_command_buffer_t buffer;
+    ecs_command_buffer_create(&buffer);
+
+    entity_t moved = entity_create(world);
+    entity_t removed = entity_create(world);
+    ENTITY_ADD_COMPONENT(world, removed, test_velocity_t);
+    entity_t destroyed = entity_create(world);
+    entity_t dead = entity_create(world);
+    entity_destroy(world, dead);
+    u32 archetype_count = world->archetypes.count;
+
+    // Each entity moves straight to its final layout, which already exists, so no archetype is created for the layouts in between
+    ECS_COMMAND_BUFFER_ADD_COMPONENT(&buffer, moved, position_t);
+    ECS_COMMAND_BUFFER_SET_COMPONENT(&buffer, moved, test_velocity_t, { .x = 1 });
+    ECS_COMMAND_BUFFER_SET_COMPONENT(&buffer, moved, test_velocity_t, { .x = 2 });
+    ECS_COMMAND_BUFFER_REMOVE_COMPONENT(&buffer, moved, position_t);
+
+    // A set followed by a remove leaves the entity without the component
+    ECS_COMMAND_BUFFER_SET_COMPONENT(&buffer, removed, test_velocity_t, { .x = 3 });
+    ECS_COMMAND_BUFFER_REMOVE_COMPONENT(&buffer, removed, test_velocity_t);
+
+    ECS_COMMAND_BUFFER_ADD_COMPONENT(&buffer, destroyed, position_t);
+    ecs_command_buffer_destroy_entity(&buffer, destroyed);
+
+    // Commands for dead entities are skipped
+    ECS_COMMAND_BUFFER_ADD_COMPONENT(&buffer, dead, position_t);
+
+    ecs_command_buffer_flush(&buffer, world);
+    TEST_EXPECT(buffer.commands.count == 0, "Flushing did not clear the buffer's commands.");
+
+    TEST_EXPECT(!ENTITY_HAS_COMPONENT(world, moved, position_t), "Component added and removed in the same flush is still on the entity.");
+    TEST_EXPECT(ENTITY_HAS_COMPONENT(world, moved, test_velocity_t), "Set component was not added.");
+    TEST_EXPECT((ENTITY_GET_COMPONENT(world, moved, test_velocity_t))->x == 2, "Expected the last set value 2, got %f", (ENTITY_GET_COMPONENT(world, moved, test_velocity_t))->x);
+    TEST_EXPECT(!ENTITY_HAS_COMPONENT(world, removed, test_velocity_t), "Component set and then removed is still on the entity.");
+    TEST_EXPECT(!entity_is_alive(world, destroyed), "Destroyed entity is still alive.");
+    TEST_EXPECT(!entity_is_alive(world, dead), "Commands for a dead entity revived it.");
+    TEST_EXPECT(world->archetypes.count == archetype_count, "Expected no new archetypes, got %d", world->archetypes.count - archetype_count);
+
+    ecs_command_buffer_destroy(&buffer);
+    ecs_world_shutdown(world);
+    return true;
+}
+
+#define DEFERRED_ENTITY_COUNT 100000
+static u8 deferred_seen[DEFERRED_ENTITY_COUNT];
+
+static void mark_deferred_positions(ecs_iterator_t* iterator) {
+    position_t* positions = ECS_ITERATOR_GET_COMPONENTS(iterator, 0);
+    for (u32 i = 0; i < iterator->entity_count; i++) {
+        deferred_seen[(u32)positions[i].x]++;
+    }
+}
+
+b8 command_buffer_deferred_create_test() {
+    ecs_world_t* world = test_world_create();
+    ecs_command_buffer_t buffer;
+    ecs_command_buffer_create(&buffer);
+
+    // Pending handles are remapped to the created entities when the buffer is flushed
+    const u32 entity_count = DEFERRED_ENTITY_COUNT;
+    for (u32 i = 0; i < entity_count; i++) {
+        entity_t entity = ecs_command_buffer_create_entity(&buffer);
+        TEST_EXPECT(ENTITY_IS_PENDING(entity), "Entity created by a command buffer is not pending.");
+        ECS_COMMAND_BUFFER_SET_COMPONENT(&buffer, entity, position_t, { .x = i });
+        if (i % 2 == 0) {
+            ECS_COMMAND_BUFFER_ADD_COMPONENT(&buffer, entity, test_velocity_t);
+        }
+    }
+
+    ecs_command_buffer_flush(&buffer, world);
+    TEST_EXPECT(world->entity_count == entity_count, "Expected %d entities, got %d", entity_count, world->entity_count);
+    TEST_EXPECT(buffer.pending_entity_count == 0, "Flushing did not reset the pending entity count.");
+
+    // Every created entity got the value recorded for its own pending handle
+    ecs_component_id components[] = { ECS_COMPONENT_ID(position_t) };
+    ecs_query_t* query = ecs_query_create(world, &(ecs_query_create_info_t) { .component_count = 1, .components = components });
+    ecs_query_iterate(query, mark_deferred_positions);
+    for (u32 i = 0; i < entity_count; i++) {
+        TEST_EXPECT(deferred_seen[i] == 1, "Expected one entity with position %d, got %d", i, deferred_seen[i]);
+    }
+
+    u32 velocity_count = 0;
+    for (u32 i = 0; i < world->archetypes.count; i++) {
+        if (ecs_component_set_contains(&world->archetypes.data[i].component_set, ECS_COMPONENT_ID(test_velocity_t))) {
+            velocity_count += world->archetypes.data[i].entities.count;
+        }
+    }
+    TEST_EXPECT(velocity_count == entity_count / 2, "Expected %d entities with test_velocity_t, got %d", entity_count / 2, velocity_count);
+
+    ecs_command_buffer_destroy(&buffer);
+    ecs_world_shutdown(world);
+    return true;
+}
+
+// Moves every entity and arms the ones marked by position.y once they reach x = 5. Commands are recorded on whichever thread runs the system.
+static void arm_system(ecs_iterator_t* iterator) {
+    position_t* positions = ECS_ITERATOR_GET_COMPONENTS(iterator, 0);
+    for (u32 i = 0; i < iterator->entity_count; i++) {
+        positions[i].x += 1;
+        if (positions[i].x == 5 && positions[i].y == 1) {
+            ECS_COMMAND_BUFFER_SET_COMPONENT(iterator->commands, iterator->entities[i], armor_t, { .value = positions[i].x });
+        }
+    }
+}
+
+// Accelerates every entity and heals the ones marked by velocity.y once they reach x = 5
+static void accelerate_heal_system(ecs_iterator_t* iterator) {
+    test_velocity_t* velocities = ECS_ITERATOR_GET_COMPONENTS(iterator, 0);
+    for (u32 i = 0; i < iterator->entity_count; i++) {
+        velocities[i].x += 1;
+        if (velocities[i].x == 5 && velocities[i].y == 1) {
+            ECS_COMMAND_BUFFER_SET_COMPONENT(iterator->commands, iterator->entities[i], health_t, { .value = velocities[i].x });
+        }
+    }
+}
+
+b8 command_buffer_worker_threads_test() {
+    ecs_world_t* world = test_world_create();
+    ecs_world_set_worker_count(world, TEST_WORKER_COUNT);
+    const u32 entity_count = 20000;
+    entity_t entities[entity_count];
+    for (u32 i = 0; i < entity_count; i++) {
+        entities[i] = entity_create(world);
+        ENTITY_SET_COMPONENT(world, entities[i], position_t, { .y = i % 10 == 0 });
+        ENTITY_SET_COMPONENT(world, entities[i], test_velocity_t, { .y = i % 10 == 5 });
+    }
+
+    // Both systems run as jobs in the same batch, each recording into the buffer of its own thread, and are flushed at the end of the phase
+    ecs_component_id position[] = { ECS_COMPONENT_ID(position_t) };
+    ecs_component_id velocity[] = { ECS_COMPONENT_ID(test_velocity_t) };
+    ecs_system_create(world, ECS_PHASE_UPDATE, &(ecs_query_create_info_t) { .component_count = 1, .components = position }, arm_system, "arm");
+    ecs_system_create(world, ECS_PHASE_UPDATE, &(ecs_query_create_info_t) { .component_count = 1, .components = velocity }, accelerate_heal_system, "accelerate_heal");
+    const u32 frame_count = 10;
+    for (u32 frame = 0; frame < frame_count; frame++) {
+        ecs_world_progress(world);
+    }
+
+    for (u32 i = 0; i < entity_count; i++) {
+        TEST_EXPECT(ENTITY_HAS_COMPONENT(world, entities[i], armor_t) == (i % 10 == 0), "Entity %d has the wrong armor.", i);
+        TEST_EXPECT(ENTITY_HAS_COMPONENT(world, entities[i], health_t) == (i % 10 == 5), "Entity %d has the wrong health.", i);
+        if (i % 10 == 0) {
+            TEST_EXPECT((ENTITY_GET_COMPONENT(world, entities[i], armor_t))->value == 5, "Entity %d armor was not set.", i);
+        } else if (i % 10 == 5) {
+            TEST_EXPECT((ENTITY_GET_COMPONENT(world, entities[i], health_t))->value == 5, "Entity %d health was not set.", i);
+        }
+        TEST_EXPECT((ENTITY_GET_COMPONENT(world, entities[i], position_t))->x == frame_count, "Entity %d lost its position when it moved.", i);
+    }
+    for (u32 i = 0; i < TEST_WORKER_COUNT + 1; i++) {
+        TEST_EXPECT(world->command_buffers[i].commands.count == 0, "Command buffer %d was not flushed.", i);
+    }
+
+    ecs_world_shutdown(world);
+    return true;
+}
+
+// ================================
+// Test runner
+// ================================
+typedef struct test_case {
+    const char* name;
+    b8 (*function)();
+} test_case_t;
+
+static const test_case_t test_cases[] = {
+    { "entity_recycling", entity_recycling_test },
+    { "entity_create_bulk", entity_create_bulk_test },
+    { "entity_remove_component", entity_remove_component_test },
+    { "archetype_edge_column_map", archetype_edge_column_map_test },
+    { "archetype_signature_lookup", archetype_signature_lookup_test },
+    { "column_alignment", column_alignment_test },
+    { "tag_components", tag_components_test },
+    { "chunked_storage", chunked_storage_test },
+    { "changed_ticks", changed_ticks_test },
+    { "sparse_storage", sparse_storage_test },
+    { "disabled_entities", disabled_entities_test },
+    { "query_parallel_iteration", query_parallel_iteration_test },
+    { "query_signature_matching", query_signature_matching_test },
+    { "query_deduplication", query_deduplication_test },
+    { "query_iterator", query_iterator_test },
+    { "query_term_columns", query_term_columns_test },
+    { "query_non_empty_matches", query_non_empty_matches_test },
+    { "query_matching_order", query_matching_order_test },
+    { "query_rarest_component", query_rarest_component_test },
+    { "query_each", query_each_test },
+    { "query_each_break", query_each_break_test },
+    { "parallel_systems", parallel_systems_test },
+    { "system_scheduling", system_scheduling_test },
+    { "world_resources", world_resources_test },
+    { "static_components", static_components_test },
+    { "command_buffer_coalescing", command_buffer_coalescing_test },
+    { "command_buffer_deferred_create", command_buffer_deferred_create_test },
+    { "command_buffer_worker_threads", command_buffer_worker_threads_test },
+};
+
+// Runs every test, or only the test named by the first argument
+s32 main(s32 argc, char** argv) {
+    u32 failed_count = 0;
+    u32 run_count = 0;
+    for (u32 i = 0; i < sizeof(test_cases) / sizeof(test_cases[0]); i++) {
+        if (argc > 1 && strcmp(argv[1], test_cases[i].name) != 0) {
+            continue;
+        }
+
+        run_count++;
+        if (test_cases[i].function()) {
+            SINFO("Test '%s' passed", test_cases[i].name);
+        } else {
+            SERROR("Test '%s' failed", test_cases[i].name);
+            failed_count++;
+        }
+    }
+
+    if (run_count == 0) {
+        SERROR("No test named '%s'", argv[1]);
+        return 1;
+    }
+    return failed_count > 0;
+}